@@ -10,6 +10,9 @@ client_state::player_details_ client_state::player_details;
 client_state::client_state() {
 	if (server_socket == -1) {
 		server_socket = no::open_socket(config::host, config::port);
+		if (server_socket != -1) {
+			no::set_socket_compression(server_socket, true);
+		}
 	}
 	window().set_swap_interval(no::swap_interval::immediate);
 	set_synchronization(no::draw_synchronization::always);
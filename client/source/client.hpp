@@ -1,6 +1,7 @@
 #pragma once
 
 #include "loop.hpp"
+#include "network.hpp"
 
 class client_state : public no::program_state {
 public:
@@ -13,6 +13,8 @@
 #include "chat.hpp"
 #include "pathfinding.hpp"
 
+#include <algorithm>
+
 game_world::game_world() {
 	name = "main";
 	objects.load();
@@ -75,171 +77,143 @@ game_state::game_state() : renderer{ world }, dragger{ mouse() } {
 		no::send_packet(server(), packet);
 	});
 
-	receive_packet_id = no::socket_event(server()).packet.listen([this](const no::io_stream& packet) {
-		no::io_stream stream{ packet.data(), packet.size(), no::io_stream::construct_by::shallow_copy };
-		int16_t type = stream.read<int16_t>();
-		switch (type) {
-		case to_client::game::move_to_tile::type:
-		{
-			to_client::game::move_to_tile packet{ stream };
-			auto player = world.objects.character(packet.player_instance_id);
-			if (player) {
-				auto& object = world.objects.object(packet.player_instance_id);
-				auto path = world.path_between(object.tile(), packet.tile);
-				if (!path.empty() && object.tile() == path.back()) {
-					path.pop_back();
-				}
-				player->start_path_movement(path);
-			} else {
-				WARNING("player not found: " << packet.player_instance_id);
-			}
-			break;
-		}
-		case to_client::game::my_player_info::type:
-		{
-			to_client::game::my_player_info packet{ stream };
-			no::io_stream objstream;
-			packet.object.write(objstream);
-			packet.player.write(objstream);
-			world.objects.add(objstream);
-			world.my_player_id = packet.object.instance_id;
-			world.my_player().object.pickable = false;
-			world.my_player().character.running = true;
-			enable_tabs();
-			variables = packet.variables;
-			quests = packet.quests;
-			break;
-		}
-		case to_client::game::other_player_joined::type:
-		{
-			to_client::game::other_player_joined packet{ stream };
-			no::io_stream objstream;
-			packet.object.write(objstream);
-			packet.player.write(objstream);
-			world.objects.add(objstream);
-			world.objects.character(packet.object.instance_id)->running = true;
-			break;
-		}
-		case to_client::game::chat_message::type:
-		{
-			to_client::game::chat_message packet{ stream };
-			add_chat_message(packet.author, packet.message);
-			break;
-		}
-		case to_client::game::combat_hit::type:
-		{
-			to_client::game::combat_hit packet{ stream };
-			add_hit_splat(packet.target_id, packet.damage);
-			auto attacker = world.objects.character(packet.attacker_id);
-			auto target = world.objects.character(packet.target_id);
-			target->stat(stat_type::health).add_effective(-packet.damage);
-			attacker->add_combat_experience(packet.damage);
-			attacker->events.attack.emit();
-			target->events.defend.emit();
-			target->target_path.clear();
-			auto& attacker_object = world.objects.object(attacker->object_id);
-			auto& target_object = world.objects.object(target->object_id);
-			attacker_object.transform.rotation.y = angle_to_goal(attacker_object.transform.position, target_object.transform.position);
-			target_object.transform.rotation.y = angle_to_goal(target_object.transform.position, attacker_object.transform.position);
-			if (attacker->stat(stat_type::health).effective() < 1) {
-				world.objects.remove(packet.attacker_id);
-			}
-			if (target->stat(stat_type::health).effective() < 1) {
-				world.objects.remove(packet.target_id);
-			}
-			break;
+	router.listen<to_client::game::my_player_info>([this](const to_client::game::my_player_info& packet) {
+		no::io_stream objstream;
+		packet.object.write(objstream);
+		packet.player.write(objstream);
+		world.objects.add(objstream);
+		world.my_player_id = packet.object.instance_id;
+		world.my_player().object.pickable = false;
+		world.my_player().character.running = true;
+		enable_tabs();
+		variables = packet.variables;
+		quests = packet.quests;
+	});
+	router.listen<to_client::game::other_player_joined>([this](const to_client::game::other_player_joined& packet) {
+		no::io_stream objstream;
+		packet.object.write(objstream);
+		packet.player.write(objstream);
+		world.objects.add(objstream);
+		world.objects.character(packet.object.instance_id)->running = true;
+	});
+	router.listen<to_client::game::world_snapshot>([this](const to_client::game::world_snapshot& packet) {
+		for (auto& player : packet.players) {
+			add_player(player);
 		}
-		case to_client::game::character_equips::type:
-		{
-			to_client::game::character_equips packet{ stream };
-			auto character = world.objects.character(packet.instance_id);
-			if (character) {
-				character->equip({ packet.item_id, packet.stack });
+		for (auto& state : packet.characters) {
+			auto character = world.objects.character(state.instance_id);
+			if (!character) {
+				continue;
 			}
-			break;
+			auto& object = world.objects.object(state.instance_id);
+			no::vector3f position = tile_index_to_world_position(state.tile);
+			object.transform.position.x = position.x;
+			object.transform.position.z = position.z;
+			auto& health = character->stat(stat_type::health);
+			health.add_effective(state.health - health.effective());
+			character->start_path_movement(state.path);
 		}
-		case to_client::game::update_character_path::type:
-		{
-			to_client::game::update_character_path packet{ stream };
-			auto character = world.objects.character(packet.instance_id);
-			if (character) {
-				character->start_path_movement(packet.path);
+		for (auto& combat : packet.combats) {
+			if (!world.objects.character(combat.attacker_id) || !world.objects.character(combat.target_id)) {
+				continue;
 			}
-			break;
+			auto& attacker_object = world.objects.object(combat.attacker_id);
+			auto& target_object = world.objects.object(combat.target_id);
+			attacker_object.transform.rotation.y = angle_to_goal(attacker_object.transform.position, target_object.transform.position);
+			target_object.transform.rotation.y = angle_to_goal(target_object.transform.position, attacker_object.transform.position);
 		}
-		case to_client::game::trade_request::type:
-		{
-			to_client::game::trade_request packet{ stream };
-			if (sent_trade_request_to_player_id == packet.trader_id) {
-				start_trading(*this, packet.trader_id);
-			} else {
-				auto trader = world.objects.character(packet.trader_id);
-				if (trader) {
-					add_chat_message("", trader->name + " wants to trade with you.");
-				}
+	});
+	router.listen<to_client::game::players_joined>([this](const to_client::game::players_joined& packet) {
+		for (auto& player : packet.players) {
+			// the announcement includes ourselves if we joined in the same tick
+			if (player.object.instance_id != world.my_player_id) {
+				add_player(player);
 			}
-			break;
 		}
-		case to_client::game::add_trade_item::type:
-		{
-			to_client::game::add_trade_item packet{ stream };
-			add_trade_item(0, packet.item);
-			break;
+	});
+	router.listen<to_client::game::entity_updates>([this](const to_client::game::entity_updates& packet) {
+		for (auto& change : replication.receive(packet.sequence, packet.bits)) {
+			apply_replicated_state(change);
 		}
-		case to_client::game::remove_trade_item::type:
-		{
-			to_client::game::remove_trade_item packet{ stream };
-			remove_trade_item(0, packet.slot);
-			break;
+		to_server::game::entity_updates_received received;
+		received.sequence = packet.sequence;
+		no::send_packet(server(), received);
+	});
+	router.listen<to_client::game::chat_message>([this](const to_client::game::chat_message& packet) {
+		add_chat_message(packet.author, packet.message);
+	});
+	router.listen<to_client::game::combat_hit>([this](const to_client::game::combat_hit& packet) {
+		add_hit_splat(packet.target_id, packet.damage);
+		auto attacker = world.objects.character(packet.attacker_id);
+		auto target = world.objects.character(packet.target_id);
+		target->stat(stat_type::health).add_effective(-packet.damage);
+		attacker->add_combat_experience(packet.damage);
+		attacker->events.attack.emit();
+		target->events.defend.emit();
+		target->target_path.clear();
+		auto& attacker_object = world.objects.object(attacker->object_id);
+		auto& target_object = world.objects.object(target->object_id);
+		attacker_object.transform.rotation.y = angle_to_goal(attacker_object.transform.position, target_object.transform.position);
+		target_object.transform.rotation.y = angle_to_goal(target_object.transform.position, attacker_object.transform.position);
+		if (attacker->stat(stat_type::health).effective() < 1) {
+			world.objects.remove(packet.attacker_id);
 		}
-		case to_client::game::trade_decision::type:
-		{
-			to_client::game::trade_decision packet{ stream };
-			notify_trade_decision(packet.accepted);
-			sent_trade_request_to_player_id = -1;
-			break;
+		if (target->stat(stat_type::health).effective() < 1) {
+			world.objects.remove(packet.target_id);
 		}
-		case to_client::game::started_fishing::type:
-		{
-			to_client::game::started_fishing packet{ stream };
-			auto character = world.objects.character(packet.instance_id);
-			if (character) {
-				character->bait_tile = packet.casted_to_tile;
-				character->events.start_fishing.emit();
-			}
-			break;
+	});
+	router.listen<to_client::game::character_equips>([this](const to_client::game::character_equips& packet) {
+		auto character = world.objects.character(packet.instance_id);
+		if (character) {
+			character->equip({ packet.item_id, packet.stack });
 		}
-		case to_client::game::fishing_progress::type:
-		{
-			to_client::game::fishing_progress packet{ stream };
-			auto character = world.objects.character(packet.instance_id);
-			if (character) {
-				character->bait_tile = packet.new_bait_tile;
-				if (packet.finished) {
-					character->events.stop_fishing.emit();
-				}
+	});
+	router.listen<to_client::game::trade_request>([this](const to_client::game::trade_request& packet) {
+		if (sent_trade_request_to_player_id == packet.trader_id) {
+			start_trading(*this, packet.trader_id);
+		} else {
+			auto trader = world.objects.character(packet.trader_id);
+			if (trader) {
+				add_chat_message("", trader->name + " wants to trade with you.");
 			}
-			break;
-		}
-		case to_client::game::fish_caught::type:
-		{
-			to_client::game::fish_caught packet{ stream };
-			auto& player = world.my_player().character;
-			player.inventory.add_from(packet.item);
-			player.stat(stat_type::fishing).add_experience(270);
-			break;
 		}
-		case to_client::game::rotate_object::type:
-		{
-			to_client::game::rotate_object packet{ stream };
-			auto& object = world.objects.object(packet.instance_id);
-			object.transform.rotation = packet.rotation;
-			break;
+	});
+	router.listen<to_client::game::add_trade_item>([this](const to_client::game::add_trade_item& packet) {
+		add_trade_item(0, packet.item);
+	});
+	router.listen<to_client::game::remove_trade_item>([this](const to_client::game::remove_trade_item& packet) {
+		remove_trade_item(0, packet.slot);
+	});
+	router.listen<to_client::game::trade_decision>([this](const to_client::game::trade_decision& packet) {
+		notify_trade_decision(packet.accepted);
+		sent_trade_request_to_player_id = -1;
+	});
+	router.listen<to_client::game::started_fishing>([this](const to_client::game::started_fishing& packet) {
+		auto character = world.objects.character(packet.instance_id);
+		if (character) {
+			character->bait_tile = packet.casted_to_tile;
+			character->events.start_fishing.emit();
 		}
-		default:
-			break;
+	});
+	router.listen<to_client::game::fishing_progress>([this](const to_client::game::fishing_progress& packet) {
+		auto character = world.objects.character(packet.instance_id);
+		if (character) {
+			character->bait_tile = packet.new_bait_tile;
+			if (packet.finished) {
+				character->events.stop_fishing.emit();
+			}
 		}
 	});
+	router.listen<to_client::game::fish_caught>([this](const to_client::game::fish_caught& packet) {
+		auto& player = world.my_player().character;
+		item_instance item{ packet.item };
+		player.inventory.add_from(item);
+		player.stat(stat_type::fishing).add_experience(270);
+	});
+	receive_packet_id = no::socket_event(server()).packet.listen([this](const no::io_stream& packet) {
+		no::io_stream stream{ packet.data(), packet.write_index(), no::io_stream::construct_by::shallow_copy };
+		router.route(stream);
+	});
 	window().set_clear_color({ 160.0f / 255.0f, 230.0f / 255.0f, 1.0f });
 }
 
@@ -336,6 +310,67 @@ void game_state::draw() {
 	draw_context_menu();
 }
 
+void game_state::add_player(const player_snapshot& player) {
+	character_object character{ player.object.instance_id };
+	for (auto item : player.equipment) {
+		character.equipment.add_from(item);
+	}
+	for (int i = 0; i < (int)player.experience.size() && i < (int)stat_type::total; i++) {
+		character.stat((stat_type)i).set_experience(player.experience[i]);
+	}
+	character.name = player.name;
+	no::io_stream stream;
+	player.object.write(stream);
+	character.write(stream);
+	world.objects.add(stream);
+	world.objects.character(player.object.instance_id)->running = true;
+}
+
+void game_state::apply_replicated_state(const replication_receiver::change& change) {
+	const auto& state = change.state;
+	const auto& previous = change.previous;
+	auto character = world.objects.character(state.instance_id);
+	if (!character) {
+		return;
+	}
+	auto& object = world.objects.object(state.instance_id);
+	no::vector2i tile = object.tile();
+	no::vector2i offset = state.tile - tile;
+	// characters walk to where the server has them, unless they are too far behind
+	if (std::abs(offset.x) > 2 || std::abs(offset.y) > 2) {
+		no::vector3f position = tile_index_to_world_position(state.tile);
+		object.transform.position.x = position.x;
+		object.transform.position.z = position.z;
+		character->target_path.clear();
+		tile = state.tile;
+	}
+	// the tiles are the server's own path, so the character walks the same way here
+	if (state.path_size > 0 && (!previous || !previous->has_same_path(state))) {
+		std::vector<no::vector2i> path; // goal first, like found paths
+		for (int i = state.path_size - 1; i >= 0; i--) {
+			path.push_back(state.path[i]);
+		}
+		path.push_back(state.tile);
+		// it may already be further along
+		if (auto walked = std::find(path.begin(), path.end(), tile); walked != path.end()) {
+			path.erase(walked, path.end());
+		}
+		character->start_path_movement(path);
+	} else if (state.path_size == 0 && (tile != state.tile || !character->target_path.empty())) {
+		std::vector<no::vector2i> path;
+		if (tile != state.tile) {
+			path.push_back(state.tile);
+		}
+		character->start_path_movement(path);
+	}
+	// the rotation is only set when the server turns the character, so it does not undo turns made by combat hits
+	if (character->target_path.empty() && (!previous || previous->rotation != state.rotation)) {
+		object.transform.rotation.y = replicated_state::rotation_degrees(state.rotation);
+	}
+	auto& health = character->stat(stat_type::health);
+	health.add_effective(state.health - health.effective());
+}
+
 no::vector2i game_state::hovered_tile() const {
 	return hovered_pixel.xy;
 }
@@ -5,6 +5,9 @@
 #include "render.hpp"
 #include "quest.hpp"
 #include "gamevar.hpp"
+#include "replication.hpp"
+
+struct player_snapshot;
 
 struct player_data {
 	character_object& character;
@@ -62,6 +65,9 @@ public:
 
 private:
 
+	void add_player(const player_snapshot& player);
+	void apply_replicated_state(const replication_receiver::change& change);
+
 	no::vector3i hovered_pixel;
 
 	int cursor_icon_id = -1;
@@ -69,6 +75,8 @@ private:
 	int mouse_scroll_id = -1;
 	int keyboard_press_id = -1;
 	int receive_packet_id = -1;
+	no::packet_router<> router;
+	replication_receiver replication;
 
 	world_view renderer;
 
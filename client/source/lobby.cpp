@@ -17,28 +17,23 @@ lobby_state::lobby_state() :
 	camera.zoom = 2.0f;
 	shader = no::create_shader(no::asset_path("shaders/sprite"));
 	color = no::get_shader_variable("uni_Color");
-	receive_packet_id = no::socket_event(server()).packet.listen([this](const no::io_stream& packet) {
-		no::io_stream stream{ packet.data(), packet.size(), no::io_stream::construct_by::shallow_copy };
-		int16_t type = stream.read<int16_t>();
-		switch (type) {
-		case to_client::lobby::login_status::type:
-		{
-			to_client::lobby::login_status packet{ stream };
-			if (packet.status == 0) {
-				status_label.render(font, "Invalid username or password.");
-			} else if (packet.status == 1) {
-				player_details.name = packet.name;
-				to_server::lobby::connect_to_world connect_packet;
-				connect_packet.world = 0;
-				no::send_packet(server(), connect_packet);
-				change_state<game_state>();
-			} else if (packet.status == 2) {
-				status_label.render(font, "This player is already logged in.");
-			}
-			break;
-		}
+	router.listen<to_client::lobby::login_status>([this](const to_client::lobby::login_status& packet) {
+		if (packet.status == 0) {
+			status_label.render(font, "Invalid username or password.");
+		} else if (packet.status == 1) {
+			player_details.name = packet.name;
+			to_server::lobby::connect_to_world connect_packet;
+			connect_packet.world = 0;
+			no::send_packet(server(), connect_packet);
+			change_state<game_state>();
+		} else if (packet.status == 2) {
+			status_label.render(font, "This player is already logged in.");
 		}
 	});
+	receive_packet_id = no::socket_event(server()).packet.listen([this](const no::io_stream& packet) {
+		no::io_stream stream{ packet.data(), packet.write_index(), no::io_stream::construct_by::shallow_copy };
+		router.route(stream);
+	});
 	window().set_clear_color(0.3f);
 	login_label.render(font, "Enter your username and password");
 	login_button.label.render(font, "Login");
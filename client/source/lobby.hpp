@@ -20,6 +20,7 @@ private:
 	int mouse_press_id = -1;
 	int keyboard_press_id = -1;
 	int receive_packet_id = -1;
+	no::packet_router<> router;
 
 	no::ortho_camera camera;
 	int shader = -1;
@@ -48,44 +48,34 @@ updater_state::updater_state() {
 
 	previous_packet.start();
 
-	receive_packet_id = no::socket_event(server()).packet.listen([this](const no::io_stream& packet) {
-		no::io_stream stream{ packet.data(), packet.size(), no::io_stream::construct_by::shallow_copy };
-		int16_t type = stream.read<int16_t>();
-		switch (type) {
-		case to_client::updates::latest_version::type:
-		{
-			to_client::updates::latest_version packet{ stream };
-			INFO("Current version: " << client_version << ". Newest version: " << packet.version);
-			if (client_version == packet.version) {
-				if (std::filesystem::is_regular_file("einheri.old")) {
-					MESSAGE("Removing old client");
-					std::filesystem::remove("einheri.old");
-				}
-				if (std::filesystem::is_directory(no::asset_path(""))) {
-					change_state<lobby_state>();
-				}
+	router.listen<to_client::updates::latest_version>([this](const to_client::updates::latest_version& packet) {
+		INFO("Current version: " << client_version << ". Newest version: " << packet.version);
+		if (client_version == packet.version) {
+			if (std::filesystem::is_regular_file("einheri.old")) {
+				MESSAGE("Removing old client");
+				std::filesystem::remove("einheri.old");
 			}
-			break;
-		}
-		case to_client::updates::file_transfer::type:
-		{
-			previous_packet.start();
-			to_client::updates::file_transfer packet{ stream };
-			auto& transfer = transfer_for_path(packet.name);
-			transfer.update(packet);
-			if (transfer.is_completed()) {
-				erase_transfer(transfer.relative_path());
-				completed_transfers++;
-				if (completed_transfers >= packet.total_files) {
-					no::platform::relaunch();
-				}
+			if (std::filesystem::is_directory(no::asset_path(""))) {
+				change_state<lobby_state>();
 			}
-			break;
 		}
-		default:
-			break;
+	});
+	router.listen<to_client::updates::file_transfer>([this](const to_client::updates::file_transfer& packet) {
+		previous_packet.start();
+		auto& transfer = transfer_for_path(packet.name);
+		transfer.update(packet);
+		if (transfer.is_completed()) {
+			erase_transfer(transfer.relative_path());
+			completed_transfers++;
+			if (completed_transfers >= packet.total_files) {
+				no::platform::relaunch();
+			}
 		}
 	});
+	receive_packet_id = no::socket_event(server()).packet.listen([this](const no::io_stream& packet) {
+		no::io_stream stream{ packet.data(), packet.write_index(), no::io_stream::construct_by::shallow_copy };
+		router.route(stream);
+	});
 }
 
 updater_state::~updater_state() {
@@ -43,5 +43,6 @@ private:
 	int completed_transfers = 0;
 	no::timer previous_packet;
 	int receive_packet_id = -1;
+	no::packet_router<> router;
 
 };
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace no {
+
+// byte oriented lz77 block codec, similar to lz4. it favours speed over ratio,
+// and is meant for network packets where every microsecond on the send path counts.
+// the compressor keeps its hash table between calls, so keep one per connection.
+class lz_compressor {
+public:
+
+	static size_t max_compressed_size(size_t size);
+
+	// returns the compressed size, or 0 if the data did not fit in the destination.
+	size_t compress(const char* source, size_t size, char* destination, size_t capacity);
+
+private:
+
+	static const int hash_bits = 12;
+	static const size_t max_offset = 0xFFFF;
+
+	// positions from previous calls are left in here. they are only used after the bytes are compared.
+	uint32_t positions[1 << hash_bits] = {};
+
+};
+
+// returns the decompressed size, or 0 if the data is corrupt or did not fit in the destination.
+size_t lz_decompress(const char* source, size_t size, char* destination, size_t capacity);
+
+}
@@ -2,16 +2,226 @@
 
 #include "debug.hpp"
 
+#include <cstddef>
 #include <functional>
+#include <new>
+#include <type_traits>
 #include <vector>
 #include <queue>
+#include <atomic>
+#include <memory>
+#include <mutex>
 
 namespace no {
 
+template<typename Signature>
+class delegate;
+
+// type-erased callable like std::function, except that small callables are stored inline.
+// most listeners only capture a few pointers, so they are created without any heap allocation.
+template<typename R, typename... Args>
+class delegate<R(Args...)> {
+public:
+
+	static const size_t inline_size = 4 * sizeof(void*);
+
+	delegate() = default;
+	delegate(std::nullptr_t) {}
+
+	template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, delegate>>>
+	delegate(F&& function) {
+		using callable = std::decay_t<F>;
+		if constexpr (std::is_constructible_v<bool, const callable&>) {
+			if (!static_cast<bool>(function)) {
+				return; // empty std::function or null function pointer
+			}
+		}
+		if constexpr (is_stored_inline<callable>()) {
+			new (storage) callable{ std::forward<F>(function) };
+		} else {
+			*reinterpret_cast<callable**>(storage) = new callable{ std::forward<F>(function) };
+		}
+		operations = &operations_for<callable>;
+	}
+
+	delegate(const delegate& that) {
+		if (that.operations) {
+			that.operations->copy(that.storage, storage);
+			operations = that.operations;
+		}
+	}
+
+	delegate(delegate&& that) {
+		if (that.operations) {
+			that.operations->move(that.storage, storage);
+			operations = that.operations;
+			that.operations = nullptr;
+		}
+	}
+
+	~delegate() {
+		reset();
+	}
+
+	delegate& operator=(const delegate& that) {
+		if (this != &that) {
+			reset();
+			if (that.operations) {
+				that.operations->copy(that.storage, storage);
+				operations = that.operations;
+			}
+		}
+		return *this;
+	}
+
+	delegate& operator=(delegate&& that) {
+		if (this != &that) {
+			reset();
+			if (that.operations) {
+				that.operations->move(that.storage, storage);
+				operations = that.operations;
+				that.operations = nullptr;
+			}
+		}
+		return *this;
+	}
+
+	R operator()(Args... args) const {
+		return operations->invoke(const_cast<char*>(storage), std::forward<Args>(args)...);
+	}
+
+	explicit operator bool() const {
+		return operations != nullptr;
+	}
+
+	void reset() {
+		if (operations) {
+			operations->destroy(storage);
+			operations = nullptr;
+		}
+	}
+
+private:
+
+	struct operations_table {
+		R(*invoke)(char* storage, Args&&... args);
+		void(*copy)(const char* source, char* destination);
+		void(*move)(char* source, char* destination);
+		void(*destroy)(char* storage);
+	};
+
+	template<typename F>
+	static constexpr bool is_stored_inline() {
+		return sizeof(F) <= inline_size && alignof(F) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<F>;
+	}
+
+	template<typename F>
+	static F& stored(char* storage) {
+		if constexpr (is_stored_inline<F>()) {
+			return *std::launder(reinterpret_cast<F*>(storage));
+		} else {
+			return **reinterpret_cast<F**>(storage);
+		}
+	}
+
+	template<typename F>
+	static inline const operations_table operations_for = {
+		[](char* storage, Args&&... args) -> R {
+			return stored<F>(storage)(std::forward<Args>(args)...);
+		},
+		[](const char* source, char* destination) {
+			if constexpr (is_stored_inline<F>()) {
+				new (destination) F{ stored<F>(const_cast<char*>(source)) };
+			} else {
+				*reinterpret_cast<F**>(destination) = new F{ stored<F>(const_cast<char*>(source)) };
+			}
+		},
+		[](char* source, char* destination) {
+			if constexpr (is_stored_inline<F>()) {
+				new (destination) F{ std::move(stored<F>(source)) };
+				stored<F>(source).~F();
+			} else {
+				*reinterpret_cast<F**>(destination) = *reinterpret_cast<F**>(source);
+			}
+		},
+		[](char* storage) {
+			if constexpr (is_stored_inline<F>()) {
+				stored<F>(storage).~F();
+			} else {
+				delete *reinterpret_cast<F**>(storage);
+			}
+		}
+	};
+
+	alignas(std::max_align_t) char storage[inline_size];
+	const operations_table* operations = nullptr;
+
+};
+
+// listeners of an event. the first few are stored inline, since most events only have one or two.
+// the id of a listener is its index, and ignored listeners leave an empty slot to be reused.
+template<typename H>
+class listener_list {
+public:
+
+	static const int inline_count = 2;
+
+	int add(const H& handler) {
+		for (int i = 0; i < count(); i++) {
+			if (!at(i)) {
+				at(i) = handler;
+				return i;
+			}
+		}
+		if (used_inline < inline_count) {
+			inline_handlers[used_inline] = handler;
+			return used_inline++;
+		}
+		overflow.push_back(handler);
+		return count() - 1;
+	}
+
+	void remove(int id) {
+		if (id >= 0 && id < count()) {
+			at(id) = {};
+		}
+	}
+
+	int count() const {
+		return used_inline + (int)overflow.size();
+	}
+
+	H& at(int index) {
+		return index < inline_count ? inline_handlers[index] : overflow[index - inline_count];
+	}
+
+	const H& at(int index) const {
+		return index < inline_count ? inline_handlers[index] : overflow[index - inline_count];
+	}
+
+	// the count is checked every iteration, so listeners added while calling are called too.
+	// each handler is copied before it is called, since adding to the overflow can move it, and removing it clears it.
+	template<typename... Args>
+	void call(const Args&... args) const {
+		for (int i = 0; i < count(); i++) {
+			if (H handler = at(i)) {
+				handler(args...);
+			}
+		}
+	}
+
+private:
+
+	H inline_handlers[inline_count];
+	int used_inline = 0;
+	std::vector<H> overflow;
+
+};
+
 class signal_event {
 public:
 
-	using handler = std::function<void()>;
+	using handler = delegate<void()>;
 
 	int listen(const handler& handler);
 	void emit() const;
@@ -21,7 +231,7 @@ public:
 
 private:
 
-	std::vector<handler> handlers;
+	listener_list<handler> handlers;
 
 };
 
@@ -29,29 +239,17 @@ template<typename M>
 class message_event {
 public:
 
-	using handler = std::function<void(const M&)>;
+	using handler = delegate<void(const M&)>;
 
 	int listen(const handler& handler) {
 		if (!handler) {
 			return -1;
 		}
-		//MESSAGE("Registering event listener #" << handlers.size() << " <" << typeid(M).name() << ">");
-		for (size_t i = 0; i < handlers.size(); i++) {
-			if (!handlers[i]) {
-				handlers[i] = handler;
-				return (int)i;
-			}
-		}
-		handlers.push_back(handler);
-		return (int)handlers.size() - 1;
+		return handlers.add(handler);
 	}
 
 	void emit(const M& event) const {
-		for (auto& handler : handlers) {
-			if (handler) {
-				handler(event);
-			}
-		}
+		handlers.call(event);
 	}
 
 	template<typename... Args>
@@ -60,18 +258,16 @@ public:
 	}
 
 	void ignore(int id) {
-		if (id >= 0 && id < (int)handlers.size()) {
-			handlers[id] = {};
-		}
+		handlers.remove(id);
 	}
 
 	int listeners() const {
-		return (int)handlers.size();
+		return handlers.count();
 	}
 
 private:
 
-	std::vector<handler> handlers;
+	listener_list<handler> handlers;
 
 };
 
@@ -124,4 +320,166 @@ private:
 
 };
 
+// lock-free ring for any number of producer threads and one consumer thread.
+// producers fill the slot in place, and the messages are kept in their slots after being consumed,
+// so any buffers owned by the messages are reused instead of being allocated for every message.
+// when the ring is full, push() puts the message in a list behind a lock instead, so nothing waits and nothing is lost.
+template<typename M>
+class event_ring_queue {
+public:
+
+	static const size_t default_capacity = 1024;
+
+	event_ring_queue(size_t capacity = default_capacity) : ring{ std::make_unique<ring_buffer>(capacity) } {}
+	event_ring_queue(const event_ring_queue&) = delete;
+	event_ring_queue(event_ring_queue&&) = default;
+
+	event_ring_queue& operator=(const event_ring_queue&) = delete;
+	event_ring_queue& operator=(event_ring_queue&&) = default;
+
+	// returns false if the queue is full
+	template<typename F>
+	bool try_push(F fill) {
+		size_t position = ring->enqueue_position.load(std::memory_order_relaxed);
+		while (true) {
+			auto& slot = ring->slots[position & ring->mask];
+			size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			auto difference = (long long)sequence - (long long)position;
+			if (difference == 0) {
+				if (ring->enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					fill(slot.message);
+					slot.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (difference < 0) {
+				return false;
+			} else {
+				position = ring->enqueue_position.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// never waits. if the ring is full, the message is added to the overflow list, and false is returned.
+	// the message order is kept for each producer, since the ring is not used again until the overflow is consumed.
+	template<typename F>
+	bool push(F fill) {
+		if (!ring->overflowing.load(std::memory_order_acquire) && try_push(fill)) {
+			return true;
+		}
+		std::lock_guard lock{ ring->overflow_mutex };
+		fill(ring->overflow.emplace_back());
+		ring->overflowing.store(true, std::memory_order_release);
+		ring->overflow_count.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	bool move_and_push(M&& message) {
+		return push([&](M& slot) {
+			slot = std::move(message);
+		});
+	}
+
+	template<typename... Args>
+	bool emplace_and_push(Args... args) {
+		return push([&](M& slot) {
+			slot = M{ std::forward<Args>(args)... };
+		});
+	}
+
+	// consumes the messages that are ready, but at most max_count. returns how many were consumed
+	// the overflow is consumed after the ring, and only once the ring is empty.
+	template<typename F>
+	size_t drain(F function, size_t max_count = SIZE_MAX) {
+		// read first, so the messages pushed to the ring before the overflow started are seen below
+		bool overflowing = ring->overflowing.load(std::memory_order_acquire);
+		size_t count = 0;
+		while (count < max_count) {
+			auto& slot = ring->slots[ring->dequeue_position & ring->mask];
+			if (slot.sequence.load(std::memory_order_acquire) != ring->dequeue_position + 1) {
+				break;
+			}
+			function(slot.message);
+			slot.sequence.store(ring->dequeue_position + ring->mask + 1, std::memory_order_release);
+			ring->dequeue_position++;
+			count++;
+		}
+		if (count == max_count || !overflowing) {
+			return count;
+		}
+		std::vector<M> overflow;
+		{
+			std::lock_guard lock{ ring->overflow_mutex };
+			std::swap(overflow, ring->overflow);
+			ring->overflowing.store(false, std::memory_order_release);
+		}
+		for (auto& message : overflow) {
+			function(message);
+		}
+		return count + overflow.size();
+	}
+
+	void all(const std::function<void(const M&)>& function) {
+		if (function) {
+			drain(function);
+		}
+	}
+
+	void emit(const message_event<M>& listener) {
+		drain([&](const M& message) {
+			listener.emit(message);
+		});
+	}
+
+	// only reliable on the consumer thread
+	bool empty() const {
+		auto& slot = ring->slots[ring->dequeue_position & ring->mask];
+		return slot.sequence.load(std::memory_order_acquire) != ring->dequeue_position + 1 && !ring->overflowing.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const {
+		return ring->mask + 1;
+	}
+
+	// how many messages did not fit in the ring since the queue was made
+	size_t overflow_count() const {
+		return ring->overflow_count.load(std::memory_order_relaxed);
+	}
+
+private:
+
+	struct ring_slot {
+		std::atomic<size_t> sequence = 0;
+		M message;
+	};
+
+	struct ring_buffer {
+
+		std::unique_ptr<ring_slot[]> slots;
+		size_t mask = 0;
+		alignas(64) std::atomic<size_t> enqueue_position = 0;
+		alignas(64) size_t dequeue_position = 0;
+		std::atomic<bool> overflowing = false;
+		std::atomic<size_t> overflow_count = 0;
+		std::mutex overflow_mutex;
+		std::vector<M> overflow;
+
+		ring_buffer(size_t capacity) {
+			// a slot's sequence can't tell a full ring from an empty one with fewer than two slots
+			size_t size = 2;
+			while (size < capacity) {
+				size *= 2;
+			}
+			slots = std::make_unique<ring_slot[]>(size);
+			mask = size - 1;
+			for (size_t i = 0; i < size; i++) {
+				slots[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+	};
+
+	std::unique_ptr<ring_buffer> ring;
+
+};
+
 }
@@ -2,6 +2,7 @@
 
 #include <cstring>
 #include <sstream>
+#include <string_view>
 #include <vector>
 
 #define STRING(X)  ((std::ostringstream&)(std::ostringstream{} << X)).str()
@@ -14,6 +15,41 @@ enum class entry_inclusion { everything, only_files, only_directories };
 std::vector<std::string> entries_in_directory(const std::string& path, entry_inclusion inclusion, bool recursive);
 std::string file_extension_in_path(const std::string& path);
 
+// non-owning view of an array inside a stream. the elements are not necessarily aligned, so they are copied on access.
+template<typename T>
+class io_array_view {
+public:
+
+	using value_type = T;
+
+	io_array_view() = default;
+	io_array_view(const char* bytes, int32_t count) : bytes(bytes), count(count) {}
+
+	T operator[](int32_t index) const {
+		T value;
+		memcpy(&value, bytes + index * sizeof(T), sizeof(T));
+		return value;
+	}
+
+	const char* data() const {
+		return bytes;
+	}
+
+	int32_t size() const {
+		return count;
+	}
+
+	size_t size_in_bytes() const {
+		return (size_t)count * sizeof(T);
+	}
+
+private:
+
+	const char* bytes = nullptr;
+	int32_t count = 0;
+
+};
+
 class io_stream {
 public:
 
@@ -144,6 +180,62 @@ public:
 		}
 	}
 
+	void write(std::string_view value) {
+		write<uint32_t>((uint32_t)value.size());
+		write(value.data(), value.size());
+	}
+
+	// the view is only valid as long as the stream's buffer is
+	std::string_view read_string_view() {
+		uint32_t length = read<uint32_t>();
+		if (read_position + length > end) {
+			return {};
+		}
+		std::string_view result{ read_position, length };
+		read_position += length;
+		return result;
+	}
+
+	template<typename T>
+	void write_array_view(io_array_view<T> values) {
+		write(values.size());
+		write(values.data(), values.size_in_bytes());
+	}
+
+	// the view is only valid as long as the stream's buffer is
+	template<typename T>
+	io_array_view<T> read_array_view() {
+		int32_t count = read<int32_t>();
+		if (count <= 0 || read_position + (size_t)count * sizeof(T) > end) {
+			return {};
+		}
+		io_array_view<T> result{ read_position, count };
+		read_position += result.size_in_bytes();
+		return result;
+	}
+
+	// little-endian base 128. small values take a single byte
+	void write_varint(uint64_t value) {
+		resize_if_needed(10);
+		while (value >= 0x80) {
+			*write_position++ = (char)(value | 0x80);
+			value >>= 7;
+		}
+		*write_position++ = (char)value;
+	}
+
+	uint64_t read_varint() {
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64 && read_position < end; shift += 7) {
+			uint8_t byte = (uint8_t)*read_position++;
+			value |= (uint64_t)(byte & 0x7F) << shift;
+			if (!(byte & 0x80)) {
+				return value;
+			}
+		}
+		return 0;
+	}
+
 	template<typename Dest, typename Src = Dest>
 	std::vector<Dest> read_array() {
 		std::vector<Dest> values;
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "event.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+namespace no {
+
+using job = delegate<void()>;
+
+// jobs that can be waited for together. jobs may add more jobs to the group they are in.
+// the waiting thread runs queued jobs until the whole group is done, so waiting inside a job is fine.
+class job_group {
+public:
+
+	job_group() = default;
+	job_group(const job_group&) = delete;
+	job_group(job_group&&) = delete;
+
+	~job_group();
+
+	job_group& operator=(const job_group&) = delete;
+	job_group& operator=(job_group&&) = delete;
+
+	void run(const job& job);
+	void wait();
+
+	bool is_done() const;
+	void finish_job();
+
+private:
+
+	std::atomic<int> pending = 0;
+
+};
+
+// workers is the number of threads in addition to the main thread. -1 uses one less than the number of cores.
+// if the job system is not started, the jobs are run immediately on the calling thread.
+void start_jobs(int workers = -1);
+void stop_jobs();
+int job_workers();
+
+void run_job(const job& job);
+
+// for continuations that must happen on the main thread, like touching the game state after a job is done
+void run_on_main_thread(const job& job);
+void run_main_thread_jobs();
+
+// calls function(begin, end) for batches of the range, and returns when all batches are done
+template<typename F>
+void parallel_for(int begin, int end, int batch_size, const F& function) {
+	if (begin >= end) {
+		return;
+	}
+	batch_size = std::max(batch_size, 1);
+	if (end - begin <= batch_size || job_workers() == 0) {
+		function(begin, end);
+		return;
+	}
+	job_group group;
+	for (int batch_begin = begin + batch_size; batch_begin < end; batch_begin += batch_size) {
+		int batch_end = std::min(batch_begin + batch_size, end);
+		group.run([&function, batch_begin, batch_end] {
+			function(batch_begin, batch_end);
+		});
+	}
+	// the calling thread takes the first batch itself
+	function(begin, std::min(begin + batch_size, end));
+	group.wait();
+}
+
+}
@@ -110,6 +110,9 @@ private:
 signal_event& post_configure_event();
 signal_event& pre_exit_event();
 
+// program states are updated at this fixed rate
+int updates_per_second();
+
 #if ENABLE_WINDOW
 
 template<typename T>
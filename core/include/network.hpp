@@ -6,6 +6,8 @@
 
 #include "event.hpp"
 #include "io.hpp"
+#include "timer.hpp"
+#include "compression.hpp"
 
 namespace no {
 
@@ -16,11 +18,29 @@ enum class socket_close_status { disconnected_gracefully, connection_reset, not_
 void start_network();
 void stop_network();
 
+struct compression_statistics {
+	long long packets_compressed = 0;
+	long long packets_decompressed = 0;
+	long long uncompressed_bytes = 0; // of the compressed packets
+	long long compressed_bytes = 0;
+	long long compress_microseconds = 0;
+	long long decompress_microseconds = 0;
+};
+
 class packetizer {
 public:
 
+	// the two leftmost bits of the body size are reserved for flags
+	static const uint32_t compressed_flag = 0x80000000;
+	static const uint32_t control_flag = 0x40000000;
+	static const uint32_t body_size_bits = 0x3FFFFFFF;
+
+	// capabilities sent in control packets
+	static const uint8_t supports_compression = 0x01;
+
 	static void start(io_stream& stream);
 	static void end(io_stream& stream);
+	static void control(io_stream& stream, uint8_t capabilities);
 
 	packetizer();
 
@@ -28,8 +48,15 @@ public:
 	size_t write_index() const;
 	void write(char* data, size_t size);
 	io_stream next();
+	io_stream next(uint32_t& flags, compression_statistics& statistics);
 	void clean();
 
+	// set when the peer sends a packet that must not be decompressed. the connection should be dropped.
+	bool is_rejected() const;
+
+	// writes a compressed copy of the packet to the destination, if it is worth it
+	static bool compress(const io_stream& packet, io_stream& destination, lz_compressor& compressor, compression_statistics& statistics);
+
 private:
 
 	using magic_type = uint32_t;
@@ -37,11 +64,52 @@ private:
 
 	static const magic_type magic = 'NFWK';
 	static const size_t header_size = sizeof(magic_type) + sizeof(body_size_type);
+	static const size_t inflated_size = 1024 * 1024 * 2;
+
+	// the size a compressed packet claims to have comes from the peer, so it is checked before anything is allocated.
+	// file transfers are the largest packets.
+	static const uint32_t max_decompressed_size = 1024 * 1024 * 64;
 
 	io_stream stream;
+	io_stream inflated; // decompressed packets are stored here until clean()
+	bool rejected = false;
+
+};
+
+// compression is negotiated per connection. both ends announce that they support it
+// with a control packet, and packets are only compressed after the other end has done so.
+struct packet_compression {
+
+	static const size_t default_threshold = 256;
+
+	bool enabled = false;
+	bool enabled_by_peer = false;
+	size_t threshold = default_threshold; // smaller packets are always sent raw
+	lz_compressor compressor;
+	io_stream buffer; // reused for every compressed packet
+	compression_statistics statistics;
+
+	bool is_active() const {
+		return enabled && enabled_by_peer;
+	}
 
 };
 
+// packets queued for a socket are written when the sockets are synchronized.
+// with coalescing, everything queued since the last flush is written with a single send.
+struct socket_send_options {
+	bool coalesce = true;
+	bool no_delay = true; // disable nagle's algorithm, since the batches are already flushed once per sync
+	int max_latency_ms = 0; // how long a partially filled batch can be held back. 0 flushes on every sync
+	size_t flush_size = 16 * 1024; // a batch is always flushed when it is at least this big
+};
+
+struct send_statistics {
+	long long packets = 0;
+	long long sends = 0;
+	long long bytes = 0;
+};
+
 struct socket_events {
 	message_event<io_stream> stream;
 	message_event<io_stream> packet;
@@ -70,6 +138,10 @@ void socket_send(int id, io_stream&& stream);
 void broadcast(io_stream&& stream);
 void broadcast(io_stream&& stream, int except_id);
 socket_events& socket_event(int id);
+void set_socket_compression(int id, bool enabled, size_t threshold = packet_compression::default_threshold);
+compression_statistics socket_compression_statistics(int id);
+void set_socket_send_options(int id, const socket_send_options& options);
+send_statistics socket_send_statistics(int id);
 
 template<typename P>
 void send_packet(int id, const P& packet) {
@@ -86,6 +158,103 @@ void broadcast(const P& packet, int except_id) {
 	broadcast(packet_stream(packet), except_id);
 }
 
+struct packet_type_statistics {
+	long long count = 0;
+	long long bytes = 0;
+	long long handler_microseconds = 0;
+};
+
+// decodes received packets and passes them to the handler registered for the type.
+// the context is passed on to the handlers, like the client index on the server.
+// packet types are grouped in scopes of 1000, so the handlers are stored in a dense table per scope.
+template<typename... Context>
+class packet_router {
+public:
+
+	static const int scope_size = 1000;
+
+	template<typename P, typename F>
+	void listen(F handler) {
+		auto& route = route_for(P::type);
+		route.handler = [handler](Context... context, io_stream& stream) {
+			handler(context..., P{ stream });
+		};
+	}
+
+	void ignore(uint16_t type) {
+		if (auto route = find(type)) {
+			route->handler = {};
+		}
+	}
+
+	// the stream must be positioned at the packet type. returns false if the type has no handler
+	bool route(Context... context, io_stream& stream) {
+		size_t size = stream.size_left_to_read();
+		auto route = find(stream.read<uint16_t>());
+		if (!route || !route->handler) {
+			return false;
+		}
+		timer handler_timer;
+		handler_timer.start();
+		route->handler(context..., stream);
+		route->statistics.count++;
+		route->statistics.bytes += size;
+		route->statistics.handler_microseconds += handler_timer.microseconds();
+		return true;
+	}
+
+	const packet_type_statistics* statistics(uint16_t type) const {
+		auto route = find(type);
+		return route ? &route->statistics : nullptr;
+	}
+
+	template<typename F>
+	void for_each_statistics(F function) const {
+		for (size_t scope = 0; scope < scopes.size(); scope++) {
+			for (size_t index = 0; index < scopes[scope].size(); index++) {
+				if (scopes[scope][index].statistics.count > 0) {
+					function((uint16_t)(scope * scope_size + index), scopes[scope][index].statistics);
+				}
+			}
+		}
+	}
+
+private:
+
+	struct packet_route {
+		std::function<void(Context..., io_stream&)> handler;
+		packet_type_statistics statistics;
+	};
+
+	packet_route& route_for(uint16_t type) {
+		size_t scope = type / scope_size;
+		size_t index = type % scope_size;
+		if (scope >= scopes.size()) {
+			scopes.resize(scope + 1);
+		}
+		if (index >= scopes[scope].size()) {
+			scopes[scope].resize(index + 1);
+		}
+		return scopes[scope][index];
+	}
+
+	packet_route* find(uint16_t type) {
+		size_t scope = type / scope_size;
+		size_t index = type % scope_size;
+		if (scope >= scopes.size() || index >= scopes[scope].size()) {
+			return nullptr;
+		}
+		return &scopes[scope][index];
+	}
+
+	const packet_route* find(uint16_t type) const {
+		return const_cast<packet_router*>(this)->find(type);
+	}
+
+	std::vector<std::vector<packet_route>> scopes;
+
+};
+
 }
 
 std::ostream& operator<<(std::ostream& out, no::socket_close_status status);
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "event.hpp"
+
+namespace no {
+
+// calls functions a number of ticks ahead. the wheel has levels of slots, where each level is coarser than the last.
+// a tick only touches the timers that fire, and the timers moving down to a finer level, which each timer does at most once per level.
+class timer_wheel {
+public:
+
+	using callback = delegate<void()>;
+
+	static const int levels = 4;
+	static const int slot_bits = 6;
+	static const int slots_per_level = 1 << slot_bits;
+
+	timer_wheel();
+	timer_wheel(const timer_wheel&) = delete;
+	timer_wheel(timer_wheel&&) = delete;
+
+	timer_wheel& operator=(const timer_wheel&) = delete;
+	timer_wheel& operator=(timer_wheel&&) = delete;
+
+	// the function is called from advance() after the given number of ticks. it is never called during this tick.
+	// the returned id stays unique, so it is safe to cancel a timer that has already fired.
+	long long schedule(long long ticks, const callback& function);
+	void cancel(long long id);
+	bool is_scheduled(long long id) const;
+
+	void advance();
+	long long tick() const;
+	int scheduled() const;
+
+private:
+
+	static const int no_entry = -1;
+	static const int firing_list = levels * slots_per_level;
+
+	struct entry {
+		callback function;
+		long long due = 0;
+		int next = no_entry;
+		int previous = no_entry;
+		int list = no_entry;
+		int generation = 0;
+	};
+
+	int entry_index(long long id) const;
+	void insert(int index);
+	void link(int index, int list);
+	void unlink(int index);
+	void release(int index);
+	void cascade(int level);
+
+	std::vector<entry> entries;
+	std::vector<int> free_entries;
+	int heads[levels * slots_per_level + 1];
+	long long current_tick = 0;
+	int active = 0;
+
+};
+
+}
@@ -0,0 +1,163 @@
+#include "compression.hpp"
+
+#include <cstring>
+
+namespace no {
+
+static const size_t min_match = 4;
+static const int run_mask = 0x0F;
+
+static uint32_t read_u32(const uint8_t* data) {
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static uint32_t hash_sequence(uint32_t sequence, int bits) {
+	return (sequence * 2654435761U) >> (32 - bits);
+}
+
+// writes the remainder of a length that did not fit in the token nibble
+static uint8_t* write_length(uint8_t* out, const uint8_t* out_end, size_t length) {
+	while (length >= 255) {
+		if (out >= out_end) {
+			return nullptr;
+		}
+		*out++ = 255;
+		length -= 255;
+	}
+	if (out >= out_end) {
+		return nullptr;
+	}
+	*out++ = (uint8_t)length;
+	return out;
+}
+
+static uint8_t* write_sequence(uint8_t* out, const uint8_t* out_end, const uint8_t* literals, size_t literal_length, size_t offset, size_t match_length) {
+	if (out >= out_end) {
+		return nullptr;
+	}
+	uint8_t* token = out++;
+	*token = (uint8_t)((literal_length >= run_mask ? run_mask : literal_length) << 4);
+	if (literal_length >= run_mask) {
+		out = write_length(out, out_end, literal_length - run_mask);
+		if (!out) {
+			return nullptr;
+		}
+	}
+	if (out + literal_length > out_end) {
+		return nullptr;
+	}
+	memcpy(out, literals, literal_length);
+	out += literal_length;
+	if (match_length == 0) {
+		return out; // last sequence has no match
+	}
+	if (out + 2 > out_end) {
+		return nullptr;
+	}
+	*out++ = (uint8_t)(offset & 0xFF);
+	*out++ = (uint8_t)(offset >> 8);
+	size_t extra = match_length - min_match;
+	*token |= (uint8_t)(extra >= run_mask ? run_mask : extra);
+	if (extra >= run_mask) {
+		out = write_length(out, out_end, extra - run_mask);
+	}
+	return out;
+}
+
+size_t lz_compressor::max_compressed_size(size_t size) {
+	return size + size / 255 + 16;
+}
+
+size_t lz_compressor::compress(const char* source, size_t size, char* destination, size_t capacity) {
+	const uint8_t* in = (const uint8_t*)source;
+	uint8_t* out = (uint8_t*)destination;
+	const uint8_t* out_end = out + capacity;
+	size_t anchor = 0;
+	size_t i = 0;
+	while (size >= min_match && i <= size - min_match) {
+		uint32_t sequence = read_u32(in + i);
+		uint32_t& slot = positions[hash_sequence(sequence, hash_bits)];
+		size_t candidate = slot;
+		slot = (uint32_t)i;
+		if (candidate >= i || i - candidate > max_offset || read_u32(in + candidate) != sequence) {
+			i++;
+			continue;
+		}
+		size_t length = min_match;
+		while (i + length < size && in[candidate + length] == in[i + length]) {
+			length++;
+		}
+		out = write_sequence(out, out_end, in + anchor, i - anchor, i - candidate, length);
+		if (!out) {
+			return 0;
+		}
+		i += length;
+		anchor = i;
+	}
+	out = write_sequence(out, out_end, in + anchor, size - anchor, 0, 0);
+	if (!out) {
+		return 0;
+	}
+	return out - (uint8_t*)destination;
+}
+
+size_t lz_decompress(const char* source, size_t size, char* destination, size_t capacity) {
+	const uint8_t* in = (const uint8_t*)source;
+	const uint8_t* in_end = in + size;
+	uint8_t* out = (uint8_t*)destination;
+	uint8_t* out_end = out + capacity;
+	const auto read_length = [&](size_t& length) {
+		uint8_t next = 255;
+		while (next == 255) {
+			if (in >= in_end) {
+				return false;
+			}
+			next = *in++;
+			length += next;
+		}
+		return true;
+	};
+	while (in < in_end) {
+		uint8_t token = *in++;
+		size_t literal_length = token >> 4;
+		if (literal_length == run_mask && !read_length(literal_length)) {
+			return 0;
+		}
+		if (in + literal_length > in_end || out + literal_length > out_end) {
+			return 0;
+		}
+		memcpy(out, in, literal_length);
+		in += literal_length;
+		out += literal_length;
+		if (in == in_end) {
+			break; // last sequence
+		}
+		if (in + 2 > in_end) {
+			return 0;
+		}
+		size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+		if (offset == 0 || offset > (size_t)(out - (uint8_t*)destination)) {
+			return 0;
+		}
+		size_t match_length = token & run_mask;
+		if (match_length == run_mask && !read_length(match_length)) {
+			return 0;
+		}
+		match_length += min_match;
+		if (out + match_length > out_end) {
+			return 0;
+		}
+		// the match may overlap with the output, so copy byte by byte
+		const uint8_t* match = out - offset;
+		for (size_t j = 0; j < match_length; j++) {
+			out[j] = match[j];
+		}
+		out += match_length;
+	}
+	return out - (uint8_t*)destination;
+}
+
+}
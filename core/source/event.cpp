@@ -6,32 +6,19 @@ int signal_event::listen(const handler& handler) {
 	if (!handler) {
 		return -1;
 	}
-	for (size_t i = 0; i < handlers.size(); i++) {
-		if (!handlers[i]) {
-			handlers[i] = handler;
-			return (int)i;
-		}
-	}
-	handlers.push_back(handler);
-	return (int)handlers.size() - 1;
+	return handlers.add(handler);
 }
 
 void signal_event::emit() const {
-	for (auto& handler : handlers) {
-		if (handler) {
-			handler();
-		}
-	}
+	handlers.call();
 }
 
 void signal_event::ignore(int id) {
-	if (id >= 0 && id < (int)handlers.size()) {
-		handlers[id] = {};
-	}
+	handlers.remove(id);
 }
 
 int signal_event::listeners() const {
-	return (int)handlers.size();
+	return handlers.count();
 }
 
 }
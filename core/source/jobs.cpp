@@ -0,0 +1,209 @@
+#include "jobs.hpp"
+#include "debug.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace no {
+
+struct queued_job {
+	job function;
+	job_group* group = nullptr;
+};
+
+// each worker has its own deque. the owner takes jobs from the back, and others steal from the front.
+// jobs queued from threads that are not workers are spread across the deques.
+struct job_worker {
+	std::mutex mutex;
+	std::deque<queued_job> jobs;
+	std::thread thread;
+};
+
+static struct {
+	std::vector<std::unique_ptr<job_worker>> workers;
+	std::atomic<int> queued = 0;
+	std::atomic<int> next_worker = 0;
+	std::atomic<bool> stopping = false;
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+	std::mutex main_thread_mutex;
+	std::vector<job> main_thread_jobs;
+	std::vector<job> running_main_thread_jobs;
+} jobs;
+
+static thread_local int current_worker = -1;
+
+static void push_job(const job& job, job_group* group) {
+	int index = current_worker;
+	if (index == -1) {
+		index = jobs.next_worker.fetch_add(1, std::memory_order_relaxed) % (int)jobs.workers.size();
+	}
+	auto& worker = *jobs.workers[index];
+	{
+		std::lock_guard lock{ worker.mutex };
+		worker.jobs.push_back({ job, group });
+	}
+	jobs.queued.fetch_add(1, std::memory_order_release);
+	{
+		// lock to make sure a worker that is about to sleep does not miss the notification
+		std::lock_guard lock{ jobs.sleep_mutex };
+	}
+	jobs.wake.notify_one();
+}
+
+static bool pop_job(queued_job& job) {
+	if (jobs.queued.load(std::memory_order_acquire) == 0) {
+		return false;
+	}
+	int count = (int)jobs.workers.size();
+	if (current_worker != -1) {
+		auto& worker = *jobs.workers[current_worker];
+		std::lock_guard lock{ worker.mutex };
+		if (!worker.jobs.empty()) {
+			job = std::move(worker.jobs.back());
+			worker.jobs.pop_back();
+			jobs.queued.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	int start = (current_worker == -1 ? 0 : current_worker + 1);
+	for (int i = 0; i < count; i++) {
+		auto& victim = *jobs.workers[(start + i) % count];
+		std::lock_guard lock{ victim.mutex };
+		if (!victim.jobs.empty()) {
+			job = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+			jobs.queued.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void run_queued_job(queued_job& job) {
+	job.function();
+	if (job.group) {
+		job.group->finish_job();
+	}
+}
+
+static void work(int index) {
+	current_worker = index;
+	while (true) {
+		queued_job job;
+		if (pop_job(job)) {
+			run_queued_job(job);
+			continue;
+		}
+		std::unique_lock lock{ jobs.sleep_mutex };
+		jobs.wake.wait(lock, [] {
+			return jobs.stopping || jobs.queued.load(std::memory_order_acquire) > 0;
+		});
+		if (jobs.stopping) {
+			return;
+		}
+	}
+}
+
+job_group::~job_group() {
+	wait();
+}
+
+void job_group::run(const job& job) {
+	if (jobs.workers.empty()) {
+		job();
+		return;
+	}
+	pending.fetch_add(1, std::memory_order_relaxed);
+	push_job(job, this);
+}
+
+void job_group::wait() {
+	while (!is_done()) {
+		queued_job job;
+		if (pop_job(job)) {
+			run_queued_job(job);
+		} else {
+			std::this_thread::yield();
+		}
+	}
+}
+
+bool job_group::is_done() const {
+	return pending.load(std::memory_order_acquire) == 0;
+}
+
+void job_group::finish_job() {
+	pending.fetch_sub(1, std::memory_order_release);
+}
+
+void start_jobs(int workers) {
+	if (!jobs.workers.empty()) {
+		WARNING("The job system is already started.");
+		return;
+	}
+	if (workers < 0) {
+		workers = std::max((int)std::thread::hardware_concurrency() - 1, 0);
+	}
+	INFO("Starting job system with " << workers << " workers");
+	jobs.stopping = false;
+	for (int i = 0; i < workers; i++) {
+		jobs.workers.emplace_back(std::make_unique<job_worker>());
+	}
+	// the workers must all exist before any of them can steal
+	for (int i = 0; i < workers; i++) {
+		jobs.workers[i]->thread = std::thread{ work, i };
+	}
+}
+
+void stop_jobs() {
+	{
+		std::lock_guard lock{ jobs.sleep_mutex };
+		jobs.stopping = true;
+	}
+	jobs.wake.notify_all();
+	for (auto& worker : jobs.workers) {
+		if (worker->thread.joinable()) {
+			worker->thread.join();
+		}
+	}
+	// jobs that were never started are run here, so groups waited for elsewhere can finish
+	queued_job job;
+	while (pop_job(job)) {
+		run_queued_job(job);
+	}
+	jobs.workers.clear();
+	jobs.queued = 0;
+	run_main_thread_jobs();
+}
+
+int job_workers() {
+	return (int)jobs.workers.size();
+}
+
+void run_job(const job& job) {
+	if (jobs.workers.empty()) {
+		job();
+	} else {
+		push_job(job, nullptr);
+	}
+}
+
+void run_on_main_thread(const job& job) {
+	std::lock_guard lock{ jobs.main_thread_mutex };
+	jobs.main_thread_jobs.push_back(job);
+}
+
+void run_main_thread_jobs() {
+	{
+		std::lock_guard lock{ jobs.main_thread_mutex };
+		std::swap(jobs.main_thread_jobs, jobs.running_main_thread_jobs);
+	}
+	for (auto& job : jobs.running_main_thread_jobs) {
+		job();
+	}
+	jobs.running_main_thread_jobs.clear();
+}
+
+}
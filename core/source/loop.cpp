@@ -9,6 +9,7 @@
 #endif
 
 #include "network.hpp"
+#include "jobs.hpp"
 
 #include <ctime>
 
@@ -85,6 +86,10 @@ signal_event& pre_exit_event() {
 	return loop.pre_exit;
 }
 
+int updates_per_second() {
+	return loop.ticks_per_second;
+}
+
 static int state_index(const program_state* state) {
 	for (size_t i = 0; i < loop.states.size(); i++) {
 		if (loop.states[i] == state) {
@@ -264,6 +269,7 @@ int run_main_loop() {
 	start_network();
 #endif
 
+	start_jobs();
 	start();
 
 	long long next_tick = loop.frame_counter.ticks();
@@ -275,6 +281,7 @@ int run_main_loop() {
 
 		bool is_updated = false;
 		while (reference_ticks - next_tick > frame_skip && update_count < loop.max_update_count) {
+			run_main_thread_jobs();
 			update_windows();
 			next_tick += frame_skip;
 			update_count++;
@@ -300,6 +307,7 @@ void destroy_main_loop() {
 	}
 	destroy_stopped_states();
 	loop.pre_exit.emit();
+	stop_jobs();
 #if ENABLE_NETWORK
 	stop_network();
 #endif
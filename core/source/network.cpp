@@ -20,6 +20,12 @@ void packetizer::end(io_stream& stream) {
 	stream.move_write_index(size);
 }
 
+void packetizer::control(io_stream& stream, uint8_t capabilities) {
+	stream.write(magic);
+	stream.write<body_size_type>(sizeof(capabilities) | control_flag);
+	stream.write(capabilities);
+}
+
 packetizer::packetizer() {
 	stream.allocate(1024 * 1024 * 10); // prevent resizes per sync. todo: improve, because this is lazy
 }
@@ -37,10 +43,19 @@ void packetizer::write(char* data, size_t size) {
 }
 
 io_stream packetizer::next() {
-	if (header_size > stream.size_left_to_read()) {
+	uint32_t flags = 0;
+	compression_statistics statistics;
+	return next(flags, statistics);
+}
+
+io_stream packetizer::next(uint32_t& flags, compression_statistics& statistics) {
+	flags = 0;
+	if (rejected || header_size > stream.size_left_to_read()) {
 		return {};
 	}
 	auto body_size = stream.peek<body_size_type>(sizeof(magic_type));
+	flags = body_size & ~body_size_bits;
+	body_size &= body_size_bits;
 	if (header_size + body_size > stream.size_left_to_read()) {
 		return {};
 	}
@@ -52,11 +67,80 @@ io_stream packetizer::next() {
 	stream.move_read_index(header_size);
 	auto body_begin = stream.at_read();
 	stream.move_read_index(body_size);
-	return { body_begin, body_size, io_stream::construct_by::shallow_copy };
+	if (!(flags & compressed_flag)) {
+		return { body_begin, body_size, io_stream::construct_by::shallow_copy };
+	}
+	if (body_size < sizeof(uint32_t)) {
+		WARNING("Compressed packet is missing its size");
+		return {};
+	}
+	uint32_t original_size = 0;
+	memcpy(&original_size, body_begin, sizeof(original_size));
+	if (original_size > max_decompressed_size || original_size <= body_size - sizeof(uint32_t)) {
+		WARNING("Rejecting compressed packet of " << body_size << " bytes claiming to be " << original_size << " bytes");
+		rejected = true;
+		return {};
+	}
+	if (!inflated.data()) {
+		inflated.allocate(inflated_size);
+	}
+	// the packet is only copied to its own buffer if it does not fit in the shared one
+	io_stream packet;
+	char* destination = inflated.at_write();
+	if (original_size > inflated.size_left_to_write()) {
+		packet.allocate(original_size);
+		destination = packet.data();
+	}
+	long long start_time = platform::performance_counter();
+	size_t size = lz_decompress(body_begin + sizeof(uint32_t), body_size - sizeof(uint32_t), destination, original_size);
+	statistics.decompress_microseconds += (platform::performance_counter() - start_time) * 1000000 / platform::performance_frequency();
+	if (size != original_size) {
+		WARNING("Failed to decompress packet of " << body_size << " bytes");
+		return {};
+	}
+	statistics.packets_decompressed++;
+	if (packet.data()) {
+		packet.set_write_index(size);
+		return packet;
+	}
+	inflated.move_write_index(size);
+	return { destination, size, io_stream::construct_by::shallow_copy };
+}
+
+bool packetizer::is_rejected() const {
+	return rejected;
 }
 
 void packetizer::clean() {
 	stream.shift_read_to_begin();
+	inflated.set_read_index(0);
+	inflated.set_write_index(0);
+}
+
+bool packetizer::compress(const io_stream& packet, io_stream& destination, lz_compressor& compressor, compression_statistics& statistics) {
+	if (header_size >= packet.write_index()) {
+		return false;
+	}
+	const size_t body_size = packet.write_index() - header_size;
+	const size_t compressed_header_size = header_size + sizeof(uint32_t);
+	const size_t capacity = lz_compressor::max_compressed_size(body_size);
+	destination.set_read_index(0);
+	destination.set_write_index(0);
+	destination.resize_if_needed(compressed_header_size + capacity);
+	long long start_time = platform::performance_counter();
+	size_t size = compressor.compress(packet.data() + header_size, body_size, destination.data() + compressed_header_size, capacity);
+	statistics.compress_microseconds += (platform::performance_counter() - start_time) * 1000000 / platform::performance_frequency();
+	if (size == 0 || size + sizeof(uint32_t) >= body_size) {
+		return false;
+	}
+	destination.write(magic);
+	destination.write<body_size_type>((body_size_type)(size + sizeof(uint32_t)) | compressed_flag);
+	destination.write<uint32_t>((uint32_t)body_size);
+	destination.move_write_index(size);
+	statistics.packets_compressed++;
+	statistics.uncompressed_bytes += body_size;
+	statistics.compressed_bytes += size + sizeof(uint32_t);
+	return true;
 }
 
 }
@@ -0,0 +1,150 @@
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+
+namespace no {
+
+timer_wheel::timer_wheel() {
+	for (auto& head : heads) {
+		head = no_entry;
+	}
+}
+
+long long timer_wheel::schedule(long long ticks, const callback& function) {
+	int index = no_entry;
+	if (free_entries.empty()) {
+		index = (int)entries.size();
+		entries.emplace_back();
+	} else {
+		index = free_entries.back();
+		free_entries.pop_back();
+	}
+	auto& timer = entries[index];
+	timer.function = function;
+	timer.due = current_tick + std::max(ticks, 1LL);
+	insert(index);
+	active++;
+	return ((long long)timer.generation << 32) | (long long)index;
+}
+
+void timer_wheel::cancel(long long id) {
+	int index = entry_index(id);
+	if (index != no_entry) {
+		unlink(index);
+		release(index);
+	}
+}
+
+bool timer_wheel::is_scheduled(long long id) const {
+	return entry_index(id) != no_entry;
+}
+
+void timer_wheel::advance() {
+	current_tick++;
+	// when a level wraps around, the next slot of the level above is spread out on the levels below
+	for (int level = 1; level < levels; level++) {
+		if ((current_tick & ((1LL << (slot_bits * level)) - 1)) != 0) {
+			break;
+		}
+		cascade(level);
+	}
+	// move the slot out of the wheel first, since the callbacks can schedule and cancel timers
+	int slot = (int)(current_tick & (slots_per_level - 1));
+	while (heads[slot] != no_entry) {
+		int index = heads[slot];
+		unlink(index);
+		link(index, firing_list);
+	}
+	while (heads[firing_list] != no_entry) {
+		int index = heads[firing_list];
+		unlink(index);
+		if (entries[index].due > current_tick) {
+			insert(index); // was further ahead than the wheel reaches
+			continue;
+		}
+		callback function = std::move(entries[index].function);
+		release(index);
+		function();
+	}
+}
+
+long long timer_wheel::tick() const {
+	return current_tick;
+}
+
+int timer_wheel::scheduled() const {
+	return active;
+}
+
+int timer_wheel::entry_index(long long id) const {
+	int index = (int)(id & 0xFFFFFFFF);
+	if (id < 0 || index >= (int)entries.size()) {
+		return no_entry;
+	}
+	auto& timer = entries[index];
+	if (timer.generation != (int)(id >> 32) || timer.list == no_entry) {
+		return no_entry;
+	}
+	return index;
+}
+
+void timer_wheel::insert(int index) {
+	long long due = entries[index].due;
+	long long delta = due - current_tick;
+	int level = 0;
+	while (level < levels - 1 && delta >= (1LL << (slot_bits * (level + 1)))) {
+		level++;
+	}
+	long long reach = (1LL << (slot_bits * levels)) - 1;
+	if (delta > reach) {
+		due = current_tick + reach;
+	}
+	int slot = (int)((due >> (slot_bits * level)) & (slots_per_level - 1));
+	link(index, level * slots_per_level + slot);
+}
+
+void timer_wheel::link(int index, int list) {
+	auto& timer = entries[index];
+	timer.list = list;
+	timer.previous = no_entry;
+	timer.next = heads[list];
+	if (timer.next != no_entry) {
+		entries[timer.next].previous = index;
+	}
+	heads[list] = index;
+}
+
+void timer_wheel::unlink(int index) {
+	auto& timer = entries[index];
+	if (timer.previous != no_entry) {
+		entries[timer.previous].next = timer.next;
+	} else {
+		heads[timer.list] = timer.next;
+	}
+	if (timer.next != no_entry) {
+		entries[timer.next].previous = timer.previous;
+	}
+	timer.list = no_entry;
+	timer.next = no_entry;
+	timer.previous = no_entry;
+}
+
+void timer_wheel::release(int index) {
+	auto& timer = entries[index];
+	timer.function = {};
+	timer.generation++;
+	free_entries.push_back(index);
+	active--;
+}
+
+void timer_wheel::cascade(int level) {
+	int slot = (int)((current_tick >> (slot_bits * level)) & (slots_per_level - 1));
+	int list = level * slots_per_level + slot;
+	while (heads[list] != no_entry) {
+		int index = heads[list];
+		unlink(index);
+		insert(index);
+	}
+}
+
+}
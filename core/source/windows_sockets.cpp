@@ -132,6 +132,16 @@ static bool create_socket(int id) {
 	return true;
 }
 
+static void apply_send_options(winsock_socket& socket) {
+	if (socket.handle == INVALID_SOCKET) {
+		return;
+	}
+	BOOL no_delay = (socket.send_options.no_delay ? TRUE : FALSE);
+	if (setsockopt(socket.handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&no_delay, sizeof(no_delay)) == SOCKET_ERROR) {
+		WS_PRINT_LAST_ERROR();
+	}
+}
+
 static bool connect_socket(int id) {
 	auto& socket = winsock.sockets[id];
 	create_socket(id);
@@ -141,6 +151,7 @@ static bool connect_socket(int id) {
 		return false;
 	}
 	socket.connected = true;
+	apply_send_options(socket);
 	return true;
 }
 
@@ -161,6 +172,13 @@ static bool connect_socket(int id, const std::string& address, int port) {
 	return connect_socket(id);
 }
 
+// one disconnect event is enough, so it is dropped rather than waited for if the queue is full
+static void queue_disconnect(winsock_socket& socket, socket_close_status status) {
+	socket.sync.disconnect.try_push([status](socket_close_status& event) {
+		event = status;
+	});
+}
+
 static bool socket_receive(int id) {
 	auto& socket = winsock.sockets[id];
 	auto data = new iocp_receive_data;
@@ -172,7 +190,7 @@ static bool socket_receive(int id) {
 		int error = WSAGetLastError();
 		switch (error) {
 		case WSAECONNRESET:
-			socket.sync.disconnect.emplace_and_push(socket_close_status::connection_reset);
+			queue_disconnect(socket, socket_close_status::connection_reset);
 			return false;
 		case WSAENOTSOCK:
 			WS_PRINT_ERROR(error);
@@ -187,19 +205,22 @@ static bool socket_receive(int id) {
 	return true;
 }
 
-static bool socket_send(int id, const io_stream& packet) {
+static bool write_to_socket(int id, io_stream&& stream) {
 	auto& socket = winsock.sockets[id];
 	auto data = new iocp_send_data;
 	socket.io.send.emplace(data);
-	data->buffer = { packet.write_index(), packet.data() };
+	data->stream = std::move(stream);
+	data->buffer = { (ULONG)data->stream.write_index(), data->stream.data() };
+	socket.send_counts.sends++;
+	socket.send_counts.bytes += data->stream.write_index();
 	// unlike regular non-blocking send(), WSASend() will complete the operation asynchronously,
-	// and this might happen before it returns. the data can immediately be discarded on return.
+	// and this might happen before it returns. only the WSABUF is captured, so the data is kept until completion.
 	int result = WSASend(socket.handle, &data->buffer, 1, &data->bytes, 0, &data->overlapped, nullptr);
 	if (result == SOCKET_ERROR) {
 		int error = WSAGetLastError();
 		switch (error) {
 		case WSAECONNRESET:
-			socket.sync.disconnect.emplace_and_push(socket_close_status::connection_reset);
+			queue_disconnect(socket, socket_close_status::connection_reset);
 			return false;
 		case WSA_IO_PENDING:
 			return true; // normal error message if the data wasn't sent immediately
@@ -211,6 +232,54 @@ static bool socket_send(int id, const io_stream& packet) {
 	return true;
 }
 
+static bool is_send_batch_due(const winsock_socket& socket) {
+	size_t size = socket.send_batch.write_index();
+	if (size == 0) {
+		return false;
+	}
+	if (!socket.send_options.coalesce || socket.send_options.max_latency_ms <= 0 || size >= socket.send_options.flush_size) {
+		return true;
+	}
+	long long elapsed_ms = (platform::performance_counter() - socket.send_batch_time) * 1000 / platform::performance_frequency();
+	return elapsed_ms >= socket.send_options.max_latency_ms;
+}
+
+// writes the queued packets, either directly or through the send batch
+static void flush_socket(int id) {
+	std::lock_guard lock{ *winsock.mutexes[id] };
+	auto& socket = winsock.sockets[id];
+	if (!socket.connected) {
+		socket.queued_packets.clear();
+		return;
+	}
+	if (!socket.send_options.coalesce && is_send_batch_due(socket)) {
+		write_to_socket(id, std::move(socket.send_batch));
+		socket.send_batch = {};
+	}
+	auto& compression = socket.compression;
+	for (auto& packet : socket.queued_packets) {
+		const io_stream* source = &packet;
+		if (compression.is_active() && packet.write_index() >= compression.threshold
+			&& packetizer::compress(packet, compression.buffer, compression.compressor, compression.statistics)) {
+			source = &compression.buffer;
+		}
+		socket.send_counts.packets++;
+		if (socket.send_options.coalesce) {
+			if (socket.send_batch.write_index() == 0) {
+				socket.send_batch_time = platform::performance_counter();
+			}
+			socket.send_batch.write(source->data(), source->write_index());
+		} else {
+			write_to_socket(id, { source->data(), source->write_index(), io_stream::construct_by::copy });
+		}
+	}
+	socket.queued_packets.clear();
+	if (is_send_batch_due(socket)) {
+		write_to_socket(id, std::move(socket.send_batch));
+		socket.send_batch = {};
+	}
+}
+
 static bool accept_ex(int id) {
 	if (!winsock.AcceptEx) {
 		return false;
@@ -264,42 +333,69 @@ DWORD io_port_thread(HANDLE io_port, int thread_num) {
 			return 0;
 		}
 		int socket_id = (int)completion_key;
-		std::lock_guard lock{ *winsock.mutexes[socket_id] };
+		std::unique_lock lock{ *winsock.mutexes[socket_id], std::defer_lock };
 		auto& socket = winsock.sockets[socket_id];
 
 		if (data->operation == iocp_operation::send) {
+			lock.lock();
 			auto send_data = (iocp_send_data*)data;
 			if (transferred == 0) {
-				socket.sync.disconnect.emplace_and_push(socket_close_status::disconnected_gracefully);
+				queue_disconnect(socket, socket_close_status::disconnected_gracefully);
 				continue;
 			}
 			socket.io.send.erase(send_data);
 			delete send_data;
 
 		} else if (data->operation == iocp_operation::receive) {
+			// there is only one pending receive per socket, so the packetizer is not shared with any other thread.
+			// the events are copied to the queues, and the game thread never has to wait for this.
 			auto receive_data = (iocp_receive_data*)data;
 			if (transferred == 0) {
-				socket.sync.disconnect.emplace_and_push(socket_close_status::disconnected_gracefully);
+				queue_disconnect(socket, socket_close_status::disconnected_gracefully);
 				continue;
 			}
-			size_t previous_write = socket.receive_packetizer.write_index();
 			socket.receive_packetizer.write(receive_data->buffer.buf, transferred);
-			// queue the stream events. use the packetizer's buffer
-			char* stream_begin = socket.receive_packetizer.data() + previous_write;
-			socket.sync.stream.emplace_and_push(stream_begin, transferred, io_stream::construct_by::shallow_copy);
+			socket.sync.stream.push([&](io_stream& stream) {
+				stream.set_read_index(0);
+				stream.set_write_index(0);
+				stream.write(receive_data->buffer.buf, transferred);
+			});
 			// parse buffer and queue packet events
+			int peer_capabilities = -1;
+			compression_statistics received;
 			while (true) {
-				io_stream packet = socket.receive_packetizer.next();
+				uint32_t flags = 0;
+				io_stream packet = socket.receive_packetizer.next(flags, received);
 				if (packet.size() == 0) {
 					break;
 				}
-				socket.sync.packet.emplace_and_push(packet.data(), packet.size_left_to_read(), io_stream::construct_by::shallow_copy);
+				if (flags & packetizer::control_flag) {
+					peer_capabilities = packet.peek<uint8_t>();
+					continue;
+				}
+				socket.sync.packet.push([&](io_stream& stream) {
+					stream.set_read_index(0);
+					stream.set_write_index(0);
+					stream.write(packet.at_read(), packet.size_left_to_read());
+				});
+			}
+			socket.receive_packetizer.clean();
+			lock.lock();
+			if (peer_capabilities != -1) {
+				socket.compression.enabled_by_peer = (peer_capabilities & packetizer::supports_compression) != 0;
 			}
+			socket.compression.statistics.packets_decompressed += received.packets_decompressed;
+			socket.compression.statistics.decompress_microseconds += received.decompress_microseconds;
 			socket.io.receive.erase(receive_data);
 			delete receive_data;
+			if (socket.receive_packetizer.is_rejected()) {
+				queue_disconnect(socket, socket_close_status::connection_reset);
+				continue;
+			}
 			socket_receive(socket_id);
 
 		} else if (data->operation == iocp_operation::accept) {
+			lock.lock();
 			auto accept_data = (iocp_accept_data*)data;
 			get_accept_sockaddrs(*accept_data);
 			auto& accepted = winsock.sockets[accept_data->accepted_id];
@@ -310,10 +406,14 @@ DWORD io_port_thread(HANDLE io_port, int thread_num) {
 				// todo: should the socket be closed here?
 			}
 			accepted.connected = true;
-			socket.sync.accept.emplace_and_push(accept_data->accepted_id);
+			apply_send_options(accepted);
+			int accepted_id = accept_data->accepted_id;
 			socket.io.accept.erase(accept_data);
 			delete accept_data;
 			increment_socket_accepts(socket_id);
+			// the game thread may need the lock to empty the queue
+			lock.unlock();
+			socket.sync.accept.push([accepted_id](int& accepted) { accepted = accepted_id; });
 		}
 	}
 	return 0;
@@ -370,23 +470,37 @@ void close_socket(int id) {
 	winsock.destroy_queue.push_back(id);
 }
 
-void synchronize_socket(int id) {
-	std::lock_guard lock{ *winsock.mutexes[id] };
+static void emit_streams(event_ring_queue<io_stream>& queue, const message_event<io_stream>& event) {
+	queue.drain([&](io_stream& stream) {
+		event.emit(stream);
+		if (stream.size() > winsock_socket::max_kept_buffer_size) {
+			stream.free();
+		}
+	});
+}
+
+static void report_overflow(int id, winsock_socket& socket) {
+	size_t overflow_count = socket.sync.stream.overflow_count() + socket.sync.packet.overflow_count() + socket.sync.accept.overflow_count();
+	if (overflow_count != socket.reported_overflow_count) {
+		WARNING("Socket " << id << ": " << overflow_count - socket.reported_overflow_count << " events did not fit in the rings since the last sync");
+		socket.reported_overflow_count = overflow_count;
+	}
+}
+
+// the events are queued in lock-free queues, so the io threads are never waited for here
+static void synchronize_socket_events(int id) {
 	auto& socket = winsock.sockets[id];
-	if (socket.sync.disconnect.size() > 0) {
+	report_overflow(id, socket);
+	if (!socket.sync.disconnect.empty()) {
 		socket.sync.disconnect.emit(socket.events.disconnect);
+		socket.connected = false; // don't flush anything to it
 		close_socket(id);
 		return;
 	}
 	if (socket.connected) {
-		socket.sync.stream.emit(socket.events.stream);
-		socket.sync.packet.emit(socket.events.packet);
-		socket.receive_packetizer.clean();
-		for (auto& packet : socket.queued_packets) {
-			socket_send(id, packet);
-		}
+		emit_streams(socket.sync.stream, socket.events.stream);
+		emit_streams(socket.sync.packet, socket.events.packet);
 	}
-	socket.queued_packets.clear();
 	if (socket.listening) {
 		socket.sync.accept.all([&](int accepted_id) {
 			socket.events.accept.emit(accepted_id);
@@ -395,10 +509,22 @@ void synchronize_socket(int id) {
 	}
 }
 
+void synchronize_socket(int id) {
+	synchronize_socket_events(id);
+	flush_socket(id);
+}
+
 void synchronize_sockets() {
 	for (int i = 0; i < (int)winsock.sockets.size(); i++) {
 		if (winsock.sockets[i].alive) {
-			synchronize_socket(i);
+			synchronize_socket_events(i);
+		}
+	}
+	// flush after all events are handled, so packets queued by other sockets' events are sent in this sync.
+	// the broadcast packets are also copied here, before the broadcast buffers are reused.
+	for (int i = 0; i < (int)winsock.sockets.size(); i++) {
+		if (winsock.sockets[i].alive) {
+			flush_socket(i);
 		}
 	}
 	winsock.broadcast_count = 0;
@@ -439,6 +565,7 @@ bool listen_socket(int id) {
 		return false;
 	}
 	socket.listening = true;
+	socket.sync.accept = event_ring_queue<int>{ winsock_socket::accepts_per_sync };
 	load_extensions(socket.handle);
 	return increment_socket_accepts(id);
 }
@@ -460,6 +587,7 @@ bool increment_socket_accepts(int id) {
 	}
 	int accept_id = open_socket();
 	winsock.sockets[accept_id].handle = accepted_handle;
+	apply_send_options(winsock.sockets[accept_id]);
 	socket.events.accept.emit(accept_id);
 	return true;
 }
@@ -486,6 +614,34 @@ void broadcast(io_stream&& stream, int except_id) {
 	winsock.broadcast_count++;
 }
 
+void set_socket_compression(int id, bool enabled, size_t threshold) {
+	std::lock_guard lock{ *winsock.mutexes[id] };
+	auto& socket = winsock.sockets[id];
+	socket.compression.enabled = enabled;
+	socket.compression.threshold = threshold;
+	// let the peer know whether we can handle compressed packets
+	io_stream stream;
+	packetizer::control(stream, enabled ? packetizer::supports_compression : 0);
+	socket.queued_packets.emplace_back(std::move(stream));
+}
+
+compression_statistics socket_compression_statistics(int id) {
+	std::lock_guard lock{ *winsock.mutexes[id] };
+	return winsock.sockets[id].compression.statistics;
+}
+
+void set_socket_send_options(int id, const socket_send_options& options) {
+	std::lock_guard lock{ *winsock.mutexes[id] };
+	auto& socket = winsock.sockets[id];
+	socket.send_options = options;
+	apply_send_options(socket);
+}
+
+send_statistics socket_send_statistics(int id) {
+	std::lock_guard lock{ *winsock.mutexes[id] };
+	return winsock.sockets[id].send_counts;
+}
+
 socket_events& socket_event(int id) {
 	return winsock.sockets[id].events;
 }
@@ -25,10 +25,13 @@ struct iocp_data {
 
 struct iocp_send_data : iocp_data<iocp_operation::send> {
 	WSABUF buffer = { 0, nullptr };
+	io_stream stream; // must be kept alive until the send is completed
 };
 
 struct iocp_receive_data : iocp_data<iocp_operation::receive> {
-	static const size_t buffer_size = 262144; // 256 KiB
+	// every connected socket has a receive pending, so this is kept small. packets split over several receives
+	// are put together by the packetizer, so bigger packets only take more receives.
+	static const size_t buffer_size = 16384; // 16 KiB
 
 	char data[buffer_size];
 	WSABUF buffer = { buffer_size, data };
@@ -56,6 +59,11 @@ struct winsock_socket {
 	bool listening = false;
 	packetizer receive_packetizer;
 	std::vector<io_stream> queued_packets;
+	packet_compression compression;
+	socket_send_options send_options;
+	send_statistics send_counts;
+	io_stream send_batch; // queued packets waiting to be written with a single send
+	long long send_batch_time = 0; // when the first packet in the batch was added
 	WSABUF received = { 0, nullptr }; // stores received buffer until a packet is recognized
 	addrinfo hints = {};
 	SOCKADDR_IN addr = {};
@@ -67,13 +75,24 @@ struct winsock_socket {
 		std::unordered_set<iocp_accept_data*> accept;
 	} io;
 
+	// every socket has these rings, so they are small. the io threads never wait for a full ring,
+	// and nothing is dropped. the events that do not fit wait in the ring's overflow list until the next sync.
+	static const size_t packets_per_sync = 128;
+	static const size_t accepts_per_sync = 256;
+
+	// buffers are kept in the ring slots to be reused, but not after a burst made them this big
+	static const size_t max_kept_buffer_size = 64 * 1024;
+
+	// filled by the io threads, and emptied when the socket is synchronized
 	struct {
-		event_message_queue<io_stream> stream;
-		event_message_queue<io_stream> packet;
-		event_message_queue<socket_close_status> disconnect;
-		event_message_queue<int> accept;
+		event_ring_queue<io_stream> stream{ 16 };
+		event_ring_queue<io_stream> packet{ packets_per_sync };
+		event_ring_queue<socket_close_status> disconnect{ 2 };
+		event_ring_queue<int> accept{ 2 }; // made bigger when the socket starts listening
 	} sync;
 
+	size_t reported_overflow_count = 0; // overflowed events that are already logged
+
 	socket_events events;
 
 	winsock_socket();
@@ -90,7 +90,6 @@ public:
 	int tiles_moved = 0;
 	bool moved_last_frame = false;
 	character_stat stats[(size_t)stat_type::total];
-	no::timer walk_around_timer;
 	no::timer last_combat_event_timer;
 	no::timer alive_timer;
 	bool fishing = false;
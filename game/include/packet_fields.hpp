@@ -0,0 +1,174 @@
+#pragma once
+
+#include "io.hpp"
+
+#include <type_traits>
+
+// serializes the fields of a packet in declaration order, with the same encoding the packets have always used:
+// booleans are one byte, enums are int32, and strings and arrays are prefixed with a 32-bit length.
+// types with their own write() and read() serialize themselves, also in arrays. everything else is copied as is,
+// and if all fields are copied as is and have no padding between them, they are copied at once.
+namespace packet_fields {
+
+// opt-in variable length encoding for integers that are usually small. signed values are zigzag encoded.
+template<typename T>
+struct varint {
+	static_assert(std::is_integral_v<T>, "Only integers can be variable length encoded.");
+
+	T value = 0;
+
+	varint() = default;
+	varint(T value) : value(value) {}
+
+	operator T() const {
+		return value;
+	}
+
+};
+
+template<typename T, typename = void>
+struct has_stream_members : std::false_type {};
+
+template<typename T>
+struct has_stream_members<T, std::void_t<decltype(std::declval<const T&>().write(std::declval<no::io_stream&>()))>> : std::true_type {};
+
+template<typename T>
+struct is_vector : std::false_type {};
+
+template<typename T>
+struct is_vector<std::vector<T>> : std::true_type {};
+
+template<typename T>
+struct is_array_view : std::false_type {};
+
+template<typename T>
+struct is_array_view<no::io_array_view<T>> : std::true_type {};
+
+template<typename T>
+struct is_varint : std::false_type {};
+
+template<typename T>
+struct is_varint<varint<T>> : std::true_type {};
+
+template<typename T>
+constexpr bool is_raw = std::is_trivially_copyable_v<T> && !std::is_same_v<T, bool> && !std::is_enum_v<T>
+	&& !std::is_same_v<T, std::string_view> && !is_array_view<T>::value && !is_varint<T>::value && !has_stream_members<T>::value;
+
+template<typename T>
+void write_field(no::io_stream& stream, const T& field) {
+	if constexpr (std::is_same_v<T, bool>) {
+		stream.write<uint8_t>(field ? 1 : 0);
+	} else if constexpr (std::is_enum_v<T>) {
+		stream.write((int32_t)field);
+	} else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+		stream.write(std::string_view{ field });
+	} else if constexpr (is_vector<T>::value) {
+		using value_type = typename T::value_type;
+		if constexpr (is_raw<value_type>) {
+			stream.write((int32_t)field.size());
+			stream.write(reinterpret_cast<const char*>(field.data()), field.size() * sizeof(value_type));
+		} else if constexpr (has_stream_members<value_type>::value) {
+			stream.write((int32_t)field.size());
+			for (auto& value : field) {
+				value.write(stream);
+			}
+		} else {
+			stream.write_array<value_type>(field);
+		}
+	} else if constexpr (is_array_view<T>::value) {
+		stream.write_array_view(field);
+	} else if constexpr (is_varint<T>::value) {
+		if constexpr (std::is_signed_v<decltype(field.value)>) {
+			int64_t value = field.value;
+			stream.write_varint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+		} else {
+			stream.write_varint(field.value);
+		}
+	} else if constexpr (has_stream_members<T>::value) {
+		field.write(stream);
+	} else {
+		static_assert(is_raw<T>, "Packet field can not be serialized.");
+		stream.write(field);
+	}
+}
+
+template<typename T>
+void read_field(no::io_stream& stream, T& field) {
+	if constexpr (std::is_same_v<T, bool>) {
+		field = (stream.read<uint8_t>() != 0);
+	} else if constexpr (std::is_enum_v<T>) {
+		field = (T)stream.read<int32_t>();
+	} else if constexpr (std::is_same_v<T, std::string>) {
+		field = stream.read<std::string>();
+	} else if constexpr (std::is_same_v<T, std::string_view>) {
+		field = stream.read_string_view();
+	} else if constexpr (is_vector<T>::value) {
+		using value_type = typename T::value_type;
+		if constexpr (is_raw<value_type>) {
+			auto view = stream.read_array_view<value_type>();
+			field.resize(view.size());
+			if (view.size() > 0) {
+				memcpy(field.data(), view.data(), view.size_in_bytes());
+			}
+		} else if constexpr (has_stream_members<value_type>::value) {
+			int32_t count = stream.read<int32_t>();
+			field.clear();
+			// a broken count can't make this read past the end of the stream
+			for (int32_t i = 0; i < count && stream.size_left_to_read() > 0; i++) {
+				field.emplace_back().read(stream);
+			}
+		} else {
+			field = stream.read_array<value_type>();
+		}
+	} else if constexpr (is_array_view<T>::value) {
+		field = stream.read_array_view<typename T::value_type>();
+	} else if constexpr (is_varint<T>::value) {
+		uint64_t value = stream.read_varint();
+		if constexpr (std::is_signed_v<decltype(field.value)>) {
+			value = (value >> 1) ^ (~(value & 1) + 1);
+		}
+		field.value = (decltype(field.value))value;
+	} else if constexpr (has_stream_members<T>::value) {
+		field.read(stream);
+	} else {
+		static_assert(is_raw<T>, "Packet field can not be deserialized.");
+		field = stream.read<T>();
+	}
+}
+
+template<typename... T>
+bool are_contiguous(const T&... fields) {
+	const char* next = nullptr;
+	bool contiguous = true;
+	((contiguous = contiguous && (!next || reinterpret_cast<const char*>(&fields) == next), next = reinterpret_cast<const char*>(&fields) + sizeof(T)), ...);
+	return contiguous;
+}
+
+template<typename First, typename... T>
+char* first_address(const First& first, const T&...) {
+	return const_cast<char*>(reinterpret_cast<const char*>(&first));
+}
+
+template<typename... T>
+void write(no::io_stream& stream, const T&... fields) {
+	if constexpr (sizeof...(T) > 0 && (is_raw<T> && ...)) {
+		if (are_contiguous(fields...)) {
+			stream.write(first_address(fields...), (sizeof(T) + ...));
+			return;
+		}
+	}
+	(write_field(stream, fields), ...);
+}
+
+template<typename... T>
+void read(no::io_stream& stream, T&... fields) {
+	if constexpr (sizeof...(T) > 0 && (is_raw<T> && ...)) {
+		if (are_contiguous(fields...)) {
+			stream.read(first_address(fields...), (sizeof(T) + ...));
+			return;
+		}
+	}
+	(read_field(stream, fields), ...);
+}
+
+}
@@ -18,6 +18,33 @@ struct NAME { \
 #define End }; }
 #define Packet(NAME, TYPE) }; Packet1(NAME, TYPE)
 
+// what a client needs to show another player
+struct player_snapshot {
+	game_object object;
+	std::string name;
+	std::vector<item_instance> equipment; // only the equipped items
+	std::vector<int64_t> experience; // by stat type
+
+	void write(no::io_stream& stream) const;
+	void read(no::io_stream& stream);
+};
+
+// the state of a character the client already has from the world
+struct character_snapshot {
+	int32_t instance_id = -1;
+	no::vector2i tile;
+	int32_t health = 0;
+	std::vector<no::vector2i> path;
+
+	void write(no::io_stream& stream) const;
+	void read(no::io_stream& stream);
+};
+
+struct combat_snapshot {
+	int32_t attacker_id = -1;
+	int32_t target_id = -1;
+};
+
 Begin(to_client::game, 0)
 
 Packet1(my_player_info, 0)
@@ -33,10 +60,6 @@ Packet(other_player_joined, 1)
 Packet(player_disconnected, 2)
 	int32_t player_instance_id = -1;
 
-Packet(move_to_tile, 3)
-	no::vector2i tile = -1;
-	int32_t player_instance_id = -1;
-
 Packet(chat_message, 4)
 	std::string author;
 	std::string message;
@@ -55,10 +78,6 @@ Packet(character_unequips, 7)
 	int32_t instance_id = -1;
 	equipment_slot slot = equipment_slot::none;
 
-Packet(update_character_path, 8)
-	int32_t instance_id = -1;
-	std::vector<no::vector2i> path;
-
 Packet(trade_request, 9)
 	int32_t trader_id = -1;
 
@@ -83,9 +102,21 @@ Packet(fishing_progress, 14)
 Packet(fish_caught, 15)
 	item_instance item;
 
-Packet(rotate_object, 16)
-	int instance_id = -1;
-	no::vector3f rotation;
+// sent once to a player entering the world. the characters and combats are the ones around the player.
+Packet(world_snapshot, 17)
+	std::vector<player_snapshot> players;
+	std::vector<character_snapshot> characters;
+	std::vector<combat_snapshot> combats;
+
+// players that entered the world this tick, sent to everyone together
+Packet(players_joined, 18)
+	std::vector<player_snapshot> players;
+
+// the characters around the player that changed, written relative to states the client has received. see replication.hpp.
+// the client answers with entity_updates_received.
+Packet(entity_updates, 19)
+	uint32_t sequence = 0;
+	std::vector<uint8_t> bits;
 
 End
 
@@ -133,6 +164,9 @@ Packet(started_fishing, 12)
 Packet(consume_from_inventory, 13)
 	no::vector2i slot;
 
+Packet(entity_updates_received, 14)
+	uint32_t sequence = 0;
+
 End
 
 Begin(to_client::lobby, 2000)
@@ -165,7 +199,7 @@ Packet(file_transfer, 1)
 	int32_t total_files = 0;
 	int64_t offset = 0;
 	int64_t total_size = 0;
-	std::vector<char> data;
+	no::io_array_view<char> data; // points into the file on send, and the received packet on receive
 
 End
 
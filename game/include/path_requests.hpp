@@ -0,0 +1,93 @@
+#pragma once
+
+#include "pathfinding.hpp"
+#include "jobs.hpp"
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+class world_state;
+
+// finds paths on the job workers, so an expensive search does not hold up the tick.
+// searches use a snapshot of the walkable tiles, and the paths are handed back in update() on a later tick.
+// when several requests share a goal, one flow field is made for the goal, and kept while it is still requested.
+class path_request_service {
+public:
+
+	// the path is in the same order as path_between() returns it, with the goal first
+	using path_found = no::delegate<void(std::vector<no::vector2i>&)>;
+
+	static const int max_searches_per_update = 64;
+	static const int min_requests_for_flow_field = 2;
+	static const int flow_field_lifetime = 10; // updates without requests before the field is thrown away
+
+	path_request_service(const world_state& world);
+	path_request_service(const path_request_service&) = delete;
+	path_request_service(path_request_service&&) = delete;
+
+	~path_request_service();
+
+	path_request_service& operator=(const path_request_service&) = delete;
+	path_request_service& operator=(path_request_service&&) = delete;
+
+	// each requester has at most one request. a new request from the same requester replaces the old one.
+	// requests with higher priority are started first.
+	int request(int requester_id, no::vector2i from, no::vector2i to, int priority, const path_found& found, path_search search = path_search::a_star);
+	void cancel(int handle);
+	void cancel_requester(int requester_id);
+	bool has_request(int requester_id) const;
+	int pending() const;
+
+	// hands out finished paths, then starts more searches
+	void update();
+
+private:
+
+	struct path_request {
+		int handle = -1;
+		int requester_id = -1;
+		int priority = 0;
+		no::vector2i from;
+		no::vector2i to;
+		path_found found;
+		path_search search = path_search::a_star;
+	};
+
+	struct finished_search {
+		int handle = -1;
+		std::vector<no::vector2i> path;
+	};
+
+	struct shared_goal_start {
+		int handle = -1;
+		no::vector2i from;
+	};
+
+	struct cached_flow_field {
+		std::shared_ptr<const flow_field> field;
+		int last_used = 0;
+	};
+
+	void finish_searches();
+	void start_searches();
+	void start_shared_goal_search(const std::shared_ptr<const walkable_grid>& grid, no::vector2i to, std::vector<shared_goal_start> starts);
+	void remove_old_flow_fields(int revision);
+
+	const world_state& world;
+	std::unordered_map<int, path_request> requests;
+	std::unordered_map<int, int> handles_by_requester;
+	std::vector<int> queued; // cancelled requests are removed when searches are started
+	int next_handle = 0;
+	int updates = 0;
+	std::unordered_map<int64_t, cached_flow_field> flow_fields;
+
+	std::mutex finished_mutex;
+	std::vector<finished_search> finished;
+	std::vector<finished_search> finishing;
+	std::vector<std::shared_ptr<const flow_field>> built_flow_fields;
+	std::vector<std::shared_ptr<const flow_field>> finishing_flow_fields;
+
+	no::job_group searches;
+
+};
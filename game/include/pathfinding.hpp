@@ -7,6 +7,44 @@
 class world_terrain;
 struct game_object;
 
+// a copy of which tiles in the loaded terrain can be walked on.
+// the copy never changes, so it can be searched on other threads while the terrain is edited or shifted.
+// walkable tiles are labelled with the region they belong to. two tiles can only be walked between if they share region.
+class walkable_grid {
+public:
+
+	static constexpr int no_region = 0;
+
+	walkable_grid(const world_terrain& terrain);
+
+	bool is_out_of_bounds(no::vector2i tile) const;
+	bool is_solid(no::vector2i tile) const;
+
+	int region_at(no::vector2i tile) const;
+	int regions() const;
+	bool is_reachable(no::vector2i from, no::vector2i to) const;
+
+	// the closest tile to 'to' that can be reached from 'from', at most max_distance tiles away from 'to'.
+	// returns 'from' if there is no such tile.
+	no::vector2i nearest_reachable(no::vector2i from, no::vector2i to, int max_distance) const;
+
+	no::vector2i offset() const;
+	no::vector2i size() const;
+	int revision() const;
+
+private:
+
+	no::vector2i grid_offset;
+	no::vector2i grid_size;
+	int terrain_revision = 0;
+	int region_count = 0;
+	std::vector<uint8_t> solid;
+	std::vector<int> region_labels;
+
+	void label_regions();
+
+};
+
 struct path_node {
 
 	static const unsigned short unused = 0;
@@ -28,23 +66,39 @@ struct path_node {
 
 };
 
+enum class path_search { a_star, jump_point };
+
 class pathfinder {
 public:
 
 	static const int max_search_area = 50;
 
-	pathfinder(const world_terrain& terrain);
+	pathfinder(const walkable_grid& grid);
 
 	bool can_search(no::vector2i from, no::vector2i to) const;
 	std::vector<no::vector2i> find_path(no::vector2i from, no::vector2i to);
 
+	// finds a path of the same cost as find_path, but skips over the many equally good tiles in open areas.
+	// the path is returned tile by tile in the same order as find_path.
+	std::vector<no::vector2i> find_jump_point_path(no::vector2i from, no::vector2i to);
+
+	std::vector<no::vector2i> find_path(no::vector2i from, no::vector2i to, path_search search);
+
 private:
 
+	bool prepare_search(no::vector2i from, no::vector2i& to);
+
 	void search_neighbours(no::vector2i to);
 	void find_best_open();
 	std::vector<no::vector2i> traverse_path(int index) const;
 
-	const world_terrain& terrain;
+	bool is_walkable(no::vector2i tile) const;
+	bool jump(no::vector2i tile, no::vector2i direction, no::vector2i to, no::vector2i& jump_point) const;
+	int pruned_directions(no::vector2i tile, no::vector2i parent, no::vector2i* directions) const;
+	std::vector<no::vector2i> traverse_jump_points(int index) const;
+	int local_index(no::vector2i tile) const;
+
+	const walkable_grid& grid;
 	std::vector<path_node> nodes;
 	bool target_reached = false;
 	int current = path_node::no_parent;
@@ -52,6 +106,40 @@ private:
 	no::vector2i min_area;
 	no::vector2i max_area;
 
+	std::vector<float> jump_costs;
+	std::vector<int> jump_parents;
+	std::vector<uint8_t> jump_closed;
+
+};
+
+// the cost of walking to one goal from every tile around it, so characters walking to the same tile can share one search.
+class flow_field {
+public:
+
+	static const int radius = pathfinder::max_search_area;
+
+	flow_field(const walkable_grid& grid, no::vector2i goal);
+
+	no::vector2i goal() const;
+	int revision() const;
+	bool can_reach_goal(no::vector2i tile) const;
+
+	// the neighbour to walk to from a tile. the tile itself if the goal can't be reached.
+	no::vector2i next_step(no::vector2i tile) const;
+
+	// same order as pathfinder::find_path, with the goal first and the tile last. empty if the goal can't be reached.
+	std::vector<no::vector2i> path_from(no::vector2i tile) const;
+
+private:
+
+	float cost_at(no::vector2i tile) const;
+
+	no::vector2i goal_tile;
+	no::vector2i min_tile;
+	int width = radius * 2 + 1;
+	int grid_revision = 0;
+	std::vector<float> costs;
+
 };
 
 float angle_to_goal(no::vector3f from, no::vector3f to);
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "math.hpp"
+
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+// what is replicated of a character. the rotation is quantized, so the client ends up with exactly what the server has.
+struct replicated_state {
+
+	// enough to keep walking until the next update, which is sent when the tile changes
+	static const int max_path_size = 8;
+
+	int instance_id = -1;
+	no::vector2i tile;
+	no::vector2i path[max_path_size]; // the next tiles the server walks the character to, nearest first
+	int path_size = 0; // 0 if it is standing still
+	uint8_t rotation = 0; // around the y axis, in 256ths of a turn
+	int health = 0;
+
+	static uint8_t quantize_rotation(float degrees);
+	static float rotation_degrees(uint8_t rotation);
+
+	bool has_same_path(const replicated_state& that) const;
+	bool operator==(const replicated_state& that) const;
+	bool operator!=(const replicated_state& that) const;
+
+};
+
+// packs values into as few bits as they need, starting from the lowest bit of each byte
+class bit_writer {
+public:
+
+	void write(uint32_t value, int bits);
+	void write_bool(bool value);
+
+	// small values take fewer bits. signed values are zigzag encoded, so small negative values are small too.
+	void write_varbits(uint32_t value);
+	void write_signed_varbits(int32_t value);
+
+	// overwrites bits that are already written, like a count that is not known until the end
+	void write_at(int bit_index, uint32_t value, int bits);
+
+	// throws away the bits written after the index
+	void truncate(int bit_index);
+
+	int size_in_bits() const;
+	const std::vector<uint8_t>& bytes() const;
+
+private:
+
+	std::vector<uint8_t> buffer;
+	int bit_count = 0;
+
+};
+
+// reading past the end gives zeros, and the reader is marked as overflowed
+class bit_reader {
+public:
+
+	bit_reader(const std::vector<uint8_t>& bytes);
+
+	uint32_t read(int bits);
+	bool read_bool();
+	uint32_t read_varbits();
+	int32_t read_signed_varbits();
+
+	bool is_overflowed() const;
+
+private:
+
+	const std::vector<uint8_t>& bytes;
+	size_t bit_index = 0;
+	bool overflowed = false;
+
+};
+
+namespace replication {
+
+// an update starts with the number of states in it, and each state is written as the fields that differ from its baseline.
+// the baseline is a state the client has confirmed it received, and is given as how many updates ago it was sent.
+// a state without a baseline is written relative to a default state.
+const int count_bits = 16;
+
+// the server does not use older baselines, so the client does not have to keep them
+const uint32_t max_baseline_age = 32;
+
+void write_state(bit_writer& writer, const replicated_state* baseline, uint32_t baseline_age, const replicated_state& state);
+
+}
+
+// rebuilds the states from the updates. the states in each update are kept for a while, since later updates are relative to them.
+class replication_receiver {
+public:
+
+	struct change {
+		replicated_state state;
+		std::optional<replicated_state> previous; // the newest state before this update, if there was one
+	};
+
+	// returns the states in the update, which are also the newest states of those characters
+	std::vector<change> receive(uint32_t sequence, const std::vector<uint8_t>& bits);
+
+private:
+
+	struct received_state {
+		uint32_t sequence = 0;
+		replicated_state state;
+	};
+
+	// oldest first
+	std::unordered_map<int, std::vector<received_state>> states;
+
+};
@@ -2,6 +2,7 @@
 
 #include "object.hpp"
 #include "world_objects.hpp"
+#include "path_requests.hpp"
 
 #include "math.hpp"
 #include "camera.hpp"
@@ -51,17 +52,26 @@ struct world_tile {
 class world_autotiler {
 public:
 
+	// corners are looked up in a dense table with 3 bits per corner. all tile types fit in this.
+	static const int bits_per_corner = 3;
+	static const int types_in_table = 1 << bits_per_corner;
+	static const int table_size = 1 << (bits_per_corner * 4);
+
 	world_autotiler();
 
 	uint32_t packed_corners(uint8_t top_left, uint8_t top_right, uint8_t bottom_left, uint8_t bottom_right) const;
 	no::vector2i uv_index(uint32_t corners) const;
+	no::vector2i uv_index(const world_tile& tile) const;
 
 private:
 
+	int table_index(uint8_t top_left, uint8_t top_right, uint8_t bottom_left, uint8_t bottom_right) const;
+	void set(uint32_t corners, no::vector2i uv);
+
 	void add_main(uint8_t tile);
 	void add_group(uint8_t tile, uint8_t bordering_tile);
 
-	std::unordered_map<uint32_t, no::vector2i> uv_indices;
+	std::vector<no::vector2i> uv_indices;
 	int row = 0;
 
 };
@@ -119,6 +129,7 @@ public:
 	world_terrain& operator=(world_terrain&&) = delete;
 
 	bool is_out_of_bounds(no::vector2i tile) const;
+	bool is_out_of_local_bounds(no::vector2i tile) const;
 	float elevation_at(no::vector2i tile) const;
 	float local_elevation_at(no::vector2i tile) const;
 	float pick_elevation_at(no::vector2i tile) const;
@@ -140,6 +151,10 @@ public:
 	no::vector3f calculate_normal(no::vector2i tile, int corner) const; // vertex normal
 	no::vector3f calculate_normal(no::vector2i tile) const; // face normal
 
+	// vertex normals for every grid point in a chunk, (width + 1)^2 of them, row by row.
+	// same result as calculate_normal(tile, corner), but each height is only fetched once.
+	void calculate_chunk_normals(int index, std::vector<no::vector3f>& normals) const;
+
 	void load_chunk(no::vector2i chunk_index, int index);
 	void save_chunk(no::vector2i chunk_index, int index) const;
 	void load(no::vector2i center_chunk);
@@ -158,11 +173,17 @@ public:
 		return world_tile_chunk::width * 3;
 	}
 
+	// changes whenever a chunk is loaded or a tile changes whether it is solid
+	int revision() const {
+		return changes;
+	}
+
 private:
 
 	std::string chunk_path(no::vector2i index) const;
 
 	world_state& world;
+	int changes = 0;
 
 };
 
@@ -171,6 +192,7 @@ public:
 
 	world_terrain terrain;
 	world_objects objects;
+	path_request_service paths;
 	std::string name;
 
 	world_state();
@@ -187,6 +209,13 @@ public:
 	std::vector<no::vector2i> path_between(no::vector2i from, no::vector2i to) const;
 	bool can_fish_at(no::vector2i from, no::vector2i to) const;
 
+	// rebuilt when the terrain has changed since the last snapshot
+	std::shared_ptr<const walkable_grid> walkable_tiles() const;
+
+private:
+
+	mutable std::shared_ptr<const walkable_grid> walkable_snapshot;
+
 };
 
 no::vector2i world_position_to_tile_index(float x, float z);
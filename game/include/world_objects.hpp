@@ -34,8 +34,11 @@ public:
 
 private:
 
+	void add_character(int instance_id);
+
 	world_state& world;
 	std::vector<game_object> objects;
 	std::vector<character_object> characters;
+	std::vector<int> character_indices; // instance id to index in characters, or -1
 
 };
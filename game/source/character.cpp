@@ -118,7 +118,6 @@ void character_object::update(world_state& world, game_object& object) {
 void character_object::start_path_movement(const std::vector<no::vector2i>& path) {
 	target_path = path;
 	tiles_moved = 0;
-	walk_around_timer.start();
 }
 
 void character_object::write(no::io_stream& stream) const {
@@ -0,0 +1,165 @@
+#include "path_requests.hpp"
+#include "world.hpp"
+
+#include <algorithm>
+
+static int64_t tile_key(no::vector2i tile) {
+	return ((int64_t)tile.x << 32) | (uint32_t)tile.y;
+}
+
+path_request_service::path_request_service(const world_state& world) : world(world) {
+
+}
+
+path_request_service::~path_request_service() {
+	searches.wait();
+}
+
+int path_request_service::request(int requester_id, no::vector2i from, no::vector2i to, int priority, const path_found& found, path_search search) {
+	cancel_requester(requester_id);
+	int handle = next_handle++;
+	requests.emplace(handle, path_request{ handle, requester_id, priority, from, to, found, search });
+	handles_by_requester[requester_id] = handle;
+	queued.push_back(handle);
+	return handle;
+}
+
+void path_request_service::cancel(int handle) {
+	// a search that has started can not be stopped, but the path is thrown away when it is finished
+	auto request = requests.find(handle);
+	if (request == requests.end()) {
+		return;
+	}
+	auto requester = handles_by_requester.find(request->second.requester_id);
+	if (requester != handles_by_requester.end() && requester->second == handle) {
+		handles_by_requester.erase(requester);
+	}
+	requests.erase(request);
+}
+
+void path_request_service::cancel_requester(int requester_id) {
+	if (auto requester = handles_by_requester.find(requester_id); requester != handles_by_requester.end()) {
+		cancel(requester->second);
+	}
+}
+
+bool path_request_service::has_request(int requester_id) const {
+	return handles_by_requester.find(requester_id) != handles_by_requester.end();
+}
+
+int path_request_service::pending() const {
+	return (int)requests.size();
+}
+
+void path_request_service::update() {
+	updates++;
+	finish_searches();
+	start_searches();
+}
+
+void path_request_service::finish_searches() {
+	{
+		std::lock_guard lock{ finished_mutex };
+		std::swap(finished, finishing);
+		std::swap(built_flow_fields, finishing_flow_fields);
+	}
+	for (auto& field : finishing_flow_fields) {
+		flow_fields[tile_key(field->goal())] = { field, updates };
+	}
+	finishing_flow_fields.clear();
+	for (auto& search : finishing) {
+		auto request = requests.find(search.handle);
+		if (request == requests.end()) {
+			continue; // cancelled
+		}
+		path_found found = std::move(request->second.found);
+		handles_by_requester.erase(request->second.requester_id);
+		requests.erase(request);
+		// the handler may request a new path for the same requester, so it is called last
+		found(search.path);
+	}
+	finishing.clear();
+}
+
+void path_request_service::start_searches() {
+	queued.erase(std::remove_if(queued.begin(), queued.end(), [this](int handle) {
+		return requests.find(handle) == requests.end();
+	}), queued.end());
+	if (queued.empty()) {
+		return;
+	}
+	std::stable_sort(queued.begin(), queued.end(), [this](int a, int b) {
+		return requests.find(a)->second.priority > requests.find(b)->second.priority;
+	});
+	auto grid = world.walkable_tiles();
+	remove_old_flow_fields(grid->revision());
+	int count = std::min((int)queued.size(), max_searches_per_update);
+	std::unordered_map<int64_t, std::vector<shared_goal_start>> shared_goals;
+	for (int i = 0; i < count; i++) {
+		auto& request = requests.find(queued[i])->second;
+		if (grid->is_reachable(request.from, request.to)) {
+			shared_goals[tile_key(request.to)].push_back({ request.handle, request.from });
+		}
+	}
+	for (int i = 0; i < count; i++) {
+		auto& request = requests.find(queued[i])->second;
+		auto shared_goal = shared_goals.find(tile_key(request.to));
+		if (shared_goal != shared_goals.end() && grid->is_reachable(request.from, request.to)) {
+			auto& starts = shared_goal->second;
+			if (starts.empty()) {
+				continue; // started along with an earlier request
+			}
+			if ((int)starts.size() >= min_requests_for_flow_field || flow_fields.count(shared_goal->first) > 0) {
+				start_shared_goal_search(grid, request.to, std::move(starts));
+				starts.clear();
+				continue;
+			}
+		}
+		searches.run([this, grid, handle = request.handle, from = request.from, to = request.to, search = request.search] {
+			auto path = pathfinder{ *grid }.find_path(from, to, search);
+			std::lock_guard lock{ finished_mutex };
+			finished.push_back({ handle, std::move(path) });
+		});
+	}
+	queued.erase(queued.begin(), queued.begin() + count);
+}
+
+void path_request_service::start_shared_goal_search(const std::shared_ptr<const walkable_grid>& grid, no::vector2i to, std::vector<shared_goal_start> starts) {
+	std::shared_ptr<const flow_field> field;
+	if (auto cached = flow_fields.find(tile_key(to)); cached != flow_fields.end()) {
+		cached->second.last_used = updates;
+		field = cached->second.field;
+	}
+	searches.run([this, grid, field, to, starts = std::move(starts)] {
+		auto shared_field = field;
+		if (!shared_field) {
+			shared_field = std::make_shared<flow_field>(*grid, to);
+		}
+		std::vector<finished_search> paths;
+		for (auto& start : starts) {
+			auto path = shared_field->path_from(start.from);
+			if (path.empty()) {
+				// the start is outside the field
+				path = pathfinder{ *grid }.find_path(start.from, to);
+			}
+			paths.push_back({ start.handle, std::move(path) });
+		}
+		std::lock_guard lock{ finished_mutex };
+		for (auto& path : paths) {
+			finished.push_back(std::move(path));
+		}
+		if (!field) {
+			built_flow_fields.push_back(shared_field);
+		}
+	});
+}
+
+void path_request_service::remove_old_flow_fields(int revision) {
+	for (auto field = flow_fields.begin(); field != flow_fields.end();) {
+		if (field->second.field->revision() != revision || updates - field->second.last_used > flow_field_lifetime) {
+			field = flow_fields.erase(field);
+		} else {
+			field++;
+		}
+	}
+}
@@ -1,6 +1,131 @@
 #include "pathfinding.hpp"
 #include "world.hpp"
 
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <queue>
+
+// same order as world_terrain::for_each_neighbour, so equally good paths are chosen the same way
+static const no::vector2i neighbour_directions[] = {
+	{ -1, 0 }, { -1, -1 }, { -1, 1 }, { 1, 0 }, { 1, -1 }, { 1, 1 }, { 0, -1 }, { 0, 1 }
+};
+
+walkable_grid::walkable_grid(const world_terrain& terrain) :
+	grid_offset(terrain.offset()), grid_size(terrain.size()), terrain_revision(terrain.revision()) {
+	solid.resize(grid_size.x * grid_size.y);
+	for (int y = 0; y < grid_size.y; y++) {
+		for (int x = 0; x < grid_size.x; x++) {
+			solid[y * grid_size.x + x] = (terrain.local_tile_at({ x, y }).is_solid() ? 1 : 0);
+		}
+	}
+	label_regions();
+}
+
+void walkable_grid::label_regions() {
+	// flood fill with the same eight directions the pathfinder can move in
+	region_labels.assign(solid.size(), no_region);
+	region_count = 0;
+	std::vector<int> stack;
+	for (int start = 0; start < (int)solid.size(); start++) {
+		if (solid[start] || region_labels[start] != no_region) {
+			continue;
+		}
+		region_count++;
+		region_labels[start] = region_count;
+		stack.push_back(start);
+		while (!stack.empty()) {
+			int index = stack.back();
+			stack.pop_back();
+			int x = index % grid_size.x;
+			int y = index / grid_size.x;
+			for (int neighbour_y = std::max(y - 1, 0); neighbour_y <= std::min(y + 1, grid_size.y - 1); neighbour_y++) {
+				for (int neighbour_x = std::max(x - 1, 0); neighbour_x <= std::min(x + 1, grid_size.x - 1); neighbour_x++) {
+					int neighbour = neighbour_y * grid_size.x + neighbour_x;
+					if (!solid[neighbour] && region_labels[neighbour] == no_region) {
+						region_labels[neighbour] = region_count;
+						stack.push_back(neighbour);
+					}
+				}
+			}
+		}
+	}
+}
+
+bool walkable_grid::is_out_of_bounds(no::vector2i tile) const {
+	tile -= grid_offset;
+	return tile.x < 0 || tile.y < 0 || tile.x >= grid_size.x || tile.y >= grid_size.y;
+}
+
+bool walkable_grid::is_solid(no::vector2i tile) const {
+	if (is_out_of_bounds(tile)) {
+		return true;
+	}
+	tile -= grid_offset;
+	return solid[tile.y * grid_size.x + tile.x] != 0;
+}
+
+int walkable_grid::region_at(no::vector2i tile) const {
+	if (is_out_of_bounds(tile)) {
+		return no_region;
+	}
+	tile -= grid_offset;
+	return region_labels[tile.y * grid_size.x + tile.x];
+}
+
+int walkable_grid::regions() const {
+	return region_count;
+}
+
+bool walkable_grid::is_reachable(no::vector2i from, no::vector2i to) const {
+	int region = region_at(from);
+	return region != no_region && region == region_at(to);
+}
+
+no::vector2i walkable_grid::nearest_reachable(no::vector2i from, no::vector2i to, int max_distance) const {
+	int region = region_at(from);
+	if (region == no_region) {
+		return from;
+	}
+	if (region_at(to) == region) {
+		return to;
+	}
+	// check rings of tiles around the target, and stop at the first ring with a reachable tile
+	for (int distance = 1; distance <= max_distance; distance++) {
+		no::vector2i nearest = from;
+		int nearest_squared = INT_MAX;
+		bool found = false;
+		for (int y = to.y - distance; y <= to.y + distance; y++) {
+			int step = (y == to.y - distance || y == to.y + distance) ? 1 : distance * 2;
+			for (int x = to.x - distance; x <= to.x + distance; x += step) {
+				int squared = (x - to.x) * (x - to.x) + (y - to.y) * (y - to.y);
+				if (squared < nearest_squared && region_at({ x, y }) == region) {
+					nearest = { x, y };
+					nearest_squared = squared;
+					found = true;
+				}
+			}
+		}
+		// the start itself may be the nearest, and then there is no need to move
+		if (found) {
+			return nearest;
+		}
+	}
+	return from;
+}
+
+no::vector2i walkable_grid::offset() const {
+	return grid_offset;
+}
+
+no::vector2i walkable_grid::size() const {
+	return grid_size;
+}
+
+int walkable_grid::revision() const {
+	return terrain_revision;
+}
+
 path_node::path_node(no::vector2i to, no::vector2i tile) : tile(tile) {
 	h = tile.to<float>().distance_to(to.to<float>());
 	f = h;
@@ -13,7 +138,7 @@ path_node::path_node(no::vector2i to, no::vector2i tile, path_node& parent, int
 	f = g + h;
 }
 
-pathfinder::pathfinder(const world_terrain& terrain) : terrain(terrain) {
+pathfinder::pathfinder(const walkable_grid& grid) : grid(grid) {
 	
 }
 
@@ -21,20 +146,37 @@ bool pathfinder::can_search(no::vector2i from, no::vector2i to) const {
 	return max_search_area > std::abs(from.x - to.x) || max_search_area > std::abs(from.y - to.y);
 }
 
-std::vector<no::vector2i> pathfinder::find_path(no::vector2i from, no::vector2i to) {
-	if (!can_search(from, to) || from == to || terrain.is_out_of_bounds(to)) {
-		return {};
+bool pathfinder::prepare_search(no::vector2i from, no::vector2i& to) {
+	if (!can_search(from, to) || from == to || grid.is_out_of_bounds(to)) {
+		return false;
 	}
-	no::vector2i original_to{ to };
-	while (terrain.tile_at(to).is_solid()) {
-		to.x += (from.x > to.x ? 1 : -1);
-		to.y += (from.y > to.y ? 1 : -1);
-		if (terrain.is_out_of_bounds(to)) {
-			return {};
+	// don't search the whole area for a tile that can't be reached. walk as close as possible instead.
+	if (grid.region_at(from) == walkable_grid::no_region) {
+		if (grid.is_solid(to)) {
+			return false;
 		}
+	} else if (!grid.is_reachable(from, to)) {
+		to = grid.nearest_reachable(from, to, max_search_area);
+	}
+	if (to == from) {
+		return false;
 	}
 	min_area = from - max_search_area;
 	max_area = from + max_search_area;
+	return true;
+}
+
+std::vector<no::vector2i> pathfinder::find_path(no::vector2i from, no::vector2i to, path_search search) {
+	switch (search) {
+	case path_search::jump_point: return find_jump_point_path(from, to);
+	default: return find_path(from, to);
+	}
+}
+
+std::vector<no::vector2i> pathfinder::find_path(no::vector2i from, no::vector2i to) {
+	if (!prepare_search(from, to)) {
+		return {};
+	}
 	target_reached = false;
 	nodes.clear();
 	nodes.emplace_back(to, from).state = path_node::marked;
@@ -51,15 +193,16 @@ std::vector<no::vector2i> pathfinder::find_path(no::vector2i from, no::vector2i
 }
 
 void pathfinder::search_neighbours(no::vector2i to) {
-	terrain.for_each_neighbour(nodes[current].tile, [&](no::vector2i tile_index, const world_tile& tile) {
-		if (tile.is_solid() || target_reached) {
-			return;
+	for (auto& direction : neighbour_directions) {
+		no::vector2i tile_index = nodes[current].tile + direction;
+		if (grid.is_solid(tile_index)) {
+			continue;
 		}
 		if (tile_index.x < min_area.x || tile_index.y < min_area.y) {
-			return;
+			continue;
 		}
 		if (tile_index.x > max_area.x || tile_index.y > max_area.y) {
-			return;
+			continue;
 		}
 		if (tile_index == to) {
 			nodes.emplace_back(to, to, nodes[current], current).state = path_node::marked;
@@ -68,16 +211,21 @@ void pathfinder::search_neighbours(no::vector2i to) {
 			return;
 		}
 		path_node neighbour{ to, tile_index, nodes[current], current };
+		bool skip = false;
 		for (auto& node : nodes) {
 			if (node.state == path_node::opened && neighbour.tile == node.tile) {
-				return; // already opened
+				skip = true; // already opened
+				break;
 			}
 			if (node.state == path_node::closed && neighbour.tile == node.tile && neighbour.f > node.f) {
-				return; // more expensive
+				skip = true; // more expensive
+				break;
 			}
 		}
-		nodes.emplace_back(neighbour).state = path_node::opened;
-	});
+		if (!skip) {
+			nodes.emplace_back(neighbour).state = path_node::opened;
+		}
+	}
 }
 
 void pathfinder::find_best_open() {
@@ -105,6 +253,265 @@ std::vector<no::vector2i> pathfinder::traverse_path(int index) const {
 	return result;
 }
 
+static float octile_distance(no::vector2i from, no::vector2i to) {
+	int x = std::abs(to.x - from.x);
+	int y = std::abs(to.y - from.y);
+	return (float)std::max(x, y) + 0.41421356f * (float)std::min(x, y);
+}
+
+static no::vector2i direction_to(no::vector2i from, no::vector2i to) {
+	return { (to.x > from.x) - (to.x < from.x), (to.y > from.y) - (to.y < from.y) };
+}
+
+std::vector<no::vector2i> pathfinder::find_jump_point_path(no::vector2i from, no::vector2i to) {
+	if (!prepare_search(from, to)) {
+		return {};
+	}
+	const int width = max_search_area * 2 + 1;
+	jump_costs.assign(width * width, FLT_MAX);
+	jump_parents.assign(width * width, -1);
+	jump_closed.assign(width * width, 0);
+	using open_tile = std::pair<float, int>;
+	std::priority_queue<open_tile, std::vector<open_tile>, std::greater<open_tile>> open;
+	int start = local_index(from);
+	jump_costs[start] = 0.0f;
+	open.emplace(octile_distance(from, to), start);
+	// if the goal can't be reached, walk to the tile that got closest, like find_path does
+	int closest = start;
+	float closest_distance = FLT_MAX;
+	no::vector2i directions[8];
+	while (!open.empty()) {
+		int index = open.top().second;
+		open.pop();
+		if (jump_closed[index]) {
+			continue;
+		}
+		jump_closed[index] = 1;
+		no::vector2i tile{ min_area.x + index % width, min_area.y + index / width };
+		if (tile == to) {
+			return traverse_jump_points(index);
+		}
+		float distance = octile_distance(tile, to);
+		if (distance < closest_distance) {
+			closest = index;
+			closest_distance = distance;
+		}
+		no::vector2i parent = tile;
+		if (jump_parents[index] != -1) {
+			parent = { min_area.x + jump_parents[index] % width, min_area.y + jump_parents[index] / width };
+		}
+		int count = pruned_directions(tile, parent, directions);
+		for (int i = 0; i < count; i++) {
+			no::vector2i jump_point;
+			if (!jump(tile, directions[i], to, jump_point)) {
+				continue;
+			}
+			int jump_index = local_index(jump_point);
+			float cost = jump_costs[index] + octile_distance(tile, jump_point);
+			if (!jump_closed[jump_index] && cost < jump_costs[jump_index]) {
+				jump_costs[jump_index] = cost;
+				jump_parents[jump_index] = index;
+				open.emplace(cost + octile_distance(jump_point, to), jump_index);
+			}
+		}
+	}
+	return traverse_jump_points(closest);
+}
+
+bool pathfinder::is_walkable(no::vector2i tile) const {
+	if (tile.x < min_area.x || tile.y < min_area.y || tile.x > max_area.x || tile.y > max_area.y) {
+		return false;
+	}
+	return !grid.is_solid(tile);
+}
+
+// diagonal steps are allowed past solid corners, like in find_path, so these are the forced neighbour rules for that
+bool pathfinder::jump(no::vector2i tile, no::vector2i direction, no::vector2i to, no::vector2i& jump_point) const {
+	const int x = direction.x;
+	const int y = direction.y;
+	while (true) {
+		tile += direction;
+		if (!is_walkable(tile)) {
+			return false;
+		}
+		if (tile == to) {
+			jump_point = tile;
+			return true;
+		}
+		if (x != 0 && y != 0) {
+			if ((!is_walkable({ tile.x - x, tile.y }) && is_walkable({ tile.x - x, tile.y + y }))
+				|| (!is_walkable({ tile.x, tile.y - y }) && is_walkable({ tile.x + x, tile.y - y }))) {
+				jump_point = tile;
+				return true;
+			}
+			no::vector2i ignored;
+			if (jump(tile, { x, 0 }, to, ignored) || jump(tile, { 0, y }, to, ignored)) {
+				jump_point = tile;
+				return true;
+			}
+		} else if (x != 0) {
+			if ((!is_walkable({ tile.x, tile.y + 1 }) && is_walkable({ tile.x + x, tile.y + 1 }))
+				|| (!is_walkable({ tile.x, tile.y - 1 }) && is_walkable({ tile.x + x, tile.y - 1 }))) {
+				jump_point = tile;
+				return true;
+			}
+		} else {
+			if ((!is_walkable({ tile.x + 1, tile.y }) && is_walkable({ tile.x + 1, tile.y + y }))
+				|| (!is_walkable({ tile.x - 1, tile.y }) && is_walkable({ tile.x - 1, tile.y + y }))) {
+				jump_point = tile;
+				return true;
+			}
+		}
+	}
+}
+
+int pathfinder::pruned_directions(no::vector2i tile, no::vector2i parent, no::vector2i* directions) const {
+	if (tile == parent) {
+		for (int i = 0; i < 8; i++) {
+			directions[i] = neighbour_directions[i];
+		}
+		return 8;
+	}
+	no::vector2i direction = direction_to(parent, tile);
+	const int x = direction.x;
+	const int y = direction.y;
+	int count = 0;
+	if (x != 0 && y != 0) {
+		directions[count++] = { x, 0 };
+		directions[count++] = { 0, y };
+		directions[count++] = { x, y };
+		if (!is_walkable({ tile.x - x, tile.y }) && is_walkable({ tile.x - x, tile.y + y })) {
+			directions[count++] = { -x, y };
+		}
+		if (!is_walkable({ tile.x, tile.y - y }) && is_walkable({ tile.x + x, tile.y - y })) {
+			directions[count++] = { x, -y };
+		}
+	} else if (x != 0) {
+		directions[count++] = { x, 0 };
+		if (!is_walkable({ tile.x, tile.y + 1 }) && is_walkable({ tile.x + x, tile.y + 1 })) {
+			directions[count++] = { x, 1 };
+		}
+		if (!is_walkable({ tile.x, tile.y - 1 }) && is_walkable({ tile.x + x, tile.y - 1 })) {
+			directions[count++] = { x, -1 };
+		}
+	} else {
+		directions[count++] = { 0, y };
+		if (!is_walkable({ tile.x + 1, tile.y }) && is_walkable({ tile.x + 1, tile.y + y })) {
+			directions[count++] = { 1, y };
+		}
+		if (!is_walkable({ tile.x - 1, tile.y }) && is_walkable({ tile.x - 1, tile.y + y })) {
+			directions[count++] = { -1, y };
+		}
+	}
+	return count;
+}
+
+std::vector<no::vector2i> pathfinder::traverse_jump_points(int index) const {
+	// fill in the tiles between the jump points, since characters walk the path one tile at a time
+	const int width = max_search_area * 2 + 1;
+	std::vector<no::vector2i> result;
+	while (index != -1) {
+		no::vector2i tile{ min_area.x + index % width, min_area.y + index / width };
+		int parent_index = jump_parents[index];
+		result.push_back(tile);
+		if (parent_index != -1) {
+			no::vector2i parent{ min_area.x + parent_index % width, min_area.y + parent_index / width };
+			no::vector2i direction = direction_to(tile, parent);
+			for (tile += direction; tile != parent; tile += direction) {
+				result.push_back(tile);
+			}
+		}
+		index = parent_index;
+	}
+	return result;
+}
+
+int pathfinder::local_index(no::vector2i tile) const {
+	return (tile.y - min_area.y) * (max_search_area * 2 + 1) + tile.x - min_area.x;
+}
+
+flow_field::flow_field(const walkable_grid& grid, no::vector2i goal) :
+	goal_tile(goal), min_tile(goal - radius), grid_revision(grid.revision()) {
+	costs.assign(width * width, FLT_MAX);
+	if (grid.is_solid(goal)) {
+		return;
+	}
+	// dijkstra outwards from the goal, with the same step costs as the pathfinder
+	using queued_tile = std::pair<float, int>;
+	std::priority_queue<queued_tile, std::vector<queued_tile>, std::greater<queued_tile>> open;
+	int goal_index = radius * width + radius;
+	costs[goal_index] = 0.0f;
+	open.emplace(0.0f, goal_index);
+	while (!open.empty()) {
+		auto [cost, index] = open.top();
+		open.pop();
+		if (cost > costs[index]) {
+			continue;
+		}
+		no::vector2i tile{ min_tile.x + index % width, min_tile.y + index / width };
+		for (auto& direction : neighbour_directions) {
+			no::vector2i neighbour = tile + direction;
+			no::vector2i local = neighbour - min_tile;
+			if (local.x < 0 || local.y < 0 || local.x >= width || local.y >= width || grid.is_solid(neighbour)) {
+				continue;
+			}
+			float neighbour_cost = cost + ((direction.x != 0 && direction.y != 0) ? 1.41421356f : 1.0f);
+			int neighbour_index = local.y * width + local.x;
+			if (neighbour_cost < costs[neighbour_index]) {
+				costs[neighbour_index] = neighbour_cost;
+				open.emplace(neighbour_cost, neighbour_index);
+			}
+		}
+	}
+}
+
+no::vector2i flow_field::goal() const {
+	return goal_tile;
+}
+
+int flow_field::revision() const {
+	return grid_revision;
+}
+
+bool flow_field::can_reach_goal(no::vector2i tile) const {
+	return cost_at(tile) < FLT_MAX;
+}
+
+no::vector2i flow_field::next_step(no::vector2i tile) const {
+	no::vector2i best = tile;
+	float best_cost = cost_at(tile);
+	for (auto& direction : neighbour_directions) {
+		float cost = cost_at(tile + direction);
+		if (cost < best_cost) {
+			best = tile + direction;
+			best_cost = cost;
+		}
+	}
+	return best;
+}
+
+std::vector<no::vector2i> flow_field::path_from(no::vector2i tile) const {
+	if (tile == goal_tile || !can_reach_goal(tile)) {
+		return {};
+	}
+	std::vector<no::vector2i> path;
+	path.push_back(tile);
+	while (tile != goal_tile) {
+		tile = next_step(tile);
+		path.push_back(tile);
+	}
+	std::reverse(path.begin(), path.end());
+	return path;
+}
+
+float flow_field::cost_at(no::vector2i tile) const {
+	no::vector2i local = tile - min_tile;
+	if (local.x < 0 || local.y < 0 || local.x >= width || local.y >= width) {
+		return FLT_MAX;
+	}
+	return costs[local.y * width + local.x];
+}
+
 float angle_to_goal(no::vector3f from, no::vector3f to) {
 	const float z = from.z - to.z;
 	const float x = from.x - to.x;
@@ -734,12 +734,13 @@ void world_view::refresh_chunk(int index) {
 	int cy = (index / 3) * world_tile_chunk::width;
 	auto& terrain = world.terrain;
 	no::vector2f step = uv_step();
+	terrain.calculate_chunk_normals(index, normals);
+	const int grid = world_tile_chunk::width + 1;
 	height_map[index].for_each([&](int i, int x, int y, std::vector<static_object_vertex>& vertices) {
 		int lx = cx + x;
 		int ly = cy + y;
 		auto& tile = terrain.local_tile_at({ lx, ly });
-		auto packed = terrain.autotiler.packed_corners(tile.corner(0), tile.corner(1), tile.corner(2), tile.corner(3));
-		no::vector2f uv = uv_for_type(world.terrain.autotiler.uv_index(packed));
+		no::vector2f uv = uv_for_type(terrain.autotiler.uv_index(tile));
 		vertices[i].position.y = tile.height;
 		vertices[i].tex_coords = uv;
 		if (i + 3 >= (int)vertices.size() || lx + 1 >= world_tile_chunk::width * 3 || ly + 1 >= world_tile_chunk::width * 3) {
@@ -752,10 +753,10 @@ void world_view::refresh_chunk(int index) {
 		vertices[i + 2].tex_coords = uv + step;
 		vertices[i + 3].tex_coords = uv + no::vector2f{ 0.0f, step.y };
 
-		vertices[i].normal = terrain.calculate_normal({ lx, ly }, 0);
-		vertices[i + 1].normal = terrain.calculate_normal({ lx, ly }, 1);
-		vertices[i + 2].normal = terrain.calculate_normal({ lx, ly }, 2);
-		vertices[i + 3].normal = terrain.calculate_normal({ lx, ly }, 3);
+		vertices[i].normal = normals[y * grid + x];
+		vertices[i + 1].normal = normals[y * grid + x + 1];
+		vertices[i + 2].normal = normals[(y + 1) * grid + x + 1];
+		vertices[i + 3].normal = normals[(y + 1) * grid + x];
 	});
 	height_map_pick[index].for_each([&](int i, int x, int y, std::vector<no::pick_vertex>& vertices) {
 		auto& tile = terrain.local_tile_at({ cx + x, cy + y });
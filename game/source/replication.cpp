@@ -0,0 +1,232 @@
+#include "replication.hpp"
+#include "debug.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+enum changed_field : uint32_t { tile_field = 1, path_field = 2, rotation_field = 4, health_field = 8 };
+
+static const int field_bits = 4;
+static const int path_size_bits = 4;
+
+// the number of bits a value is written with, chosen by a two bit prefix
+static const int varbits_sizes[4] = { 4, 8, 16, 32 };
+
+uint8_t replicated_state::quantize_rotation(float degrees) {
+	float turns = std::fmod(degrees / 360.0f, 1.0f);
+	if (turns < 0.0f) {
+		turns += 1.0f;
+	}
+	return (uint8_t)((int)std::round(turns * 256.0f) & 255);
+}
+
+float replicated_state::rotation_degrees(uint8_t rotation) {
+	return (float)rotation * 360.0f / 256.0f;
+}
+
+bool replicated_state::has_same_path(const replicated_state& that) const {
+	return path_size == that.path_size && std::equal(path, path + path_size, that.path);
+}
+
+bool replicated_state::operator==(const replicated_state& that) const {
+	return instance_id == that.instance_id && tile == that.tile && has_same_path(that) && rotation == that.rotation && health == that.health;
+}
+
+bool replicated_state::operator!=(const replicated_state& that) const {
+	return !operator==(that);
+}
+
+void bit_writer::write(uint32_t value, int bits) {
+	for (int i = 0; i < bits; i++, bit_count++) {
+		if (bit_count % 8 == 0) {
+			buffer.push_back(0);
+		}
+		if ((value >> i) & 1) {
+			buffer.back() |= (uint8_t)(1 << (bit_count % 8));
+		}
+	}
+}
+
+void bit_writer::write_bool(bool value) {
+	write(value ? 1 : 0, 1);
+}
+
+void bit_writer::write_varbits(uint32_t value) {
+	int size = 0;
+	while (size < 3 && (uint64_t)value >= (1ull << varbits_sizes[size])) {
+		size++;
+	}
+	write(size, 2);
+	write(value, varbits_sizes[size]);
+}
+
+void bit_writer::write_signed_varbits(int32_t value) {
+	write_varbits(((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+void bit_writer::write_at(int bit_index, uint32_t value, int bits) {
+	for (int i = 0; i < bits; i++) {
+		int bit = bit_index + i;
+		uint8_t mask = (uint8_t)(1 << (bit % 8));
+		if ((value >> i) & 1) {
+			buffer[bit / 8] |= mask;
+		} else {
+			buffer[bit / 8] &= ~mask;
+		}
+	}
+}
+
+void bit_writer::truncate(int bit_index) {
+	bit_count = bit_index;
+	buffer.resize((bit_count + 7) / 8);
+	if (bit_count % 8 != 0) {
+		buffer.back() &= (uint8_t)((1 << (bit_count % 8)) - 1);
+	}
+}
+
+int bit_writer::size_in_bits() const {
+	return bit_count;
+}
+
+const std::vector<uint8_t>& bit_writer::bytes() const {
+	return buffer;
+}
+
+bit_reader::bit_reader(const std::vector<uint8_t>& bytes) : bytes{ bytes } {
+
+}
+
+uint32_t bit_reader::read(int bits) {
+	uint32_t value = 0;
+	for (int i = 0; i < bits; i++, bit_index++) {
+		if (bit_index / 8 >= bytes.size()) {
+			overflowed = true;
+			return value;
+		}
+		if ((bytes[bit_index / 8] >> (bit_index % 8)) & 1) {
+			value |= 1u << i;
+		}
+	}
+	return value;
+}
+
+bool bit_reader::read_bool() {
+	return read(1) != 0;
+}
+
+uint32_t bit_reader::read_varbits() {
+	return read(varbits_sizes[read(2)]);
+}
+
+int32_t bit_reader::read_signed_varbits() {
+	uint32_t value = read_varbits();
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+bool bit_reader::is_overflowed() const {
+	return overflowed;
+}
+
+namespace replication {
+
+void write_state(bit_writer& writer, const replicated_state* baseline, uint32_t baseline_age, const replicated_state& state) {
+	replicated_state empty;
+	if (!baseline) {
+		baseline = &empty;
+		baseline_age = 0;
+	}
+	uint32_t fields = 0;
+	fields |= (state.tile != baseline->tile ? tile_field : 0);
+	fields |= (!state.has_same_path(*baseline) ? path_field : 0);
+	fields |= (state.rotation != baseline->rotation ? rotation_field : 0);
+	fields |= (state.health != baseline->health ? health_field : 0);
+	writer.write_varbits((uint32_t)state.instance_id);
+	writer.write_varbits(baseline_age);
+	writer.write(fields, field_bits);
+	if (fields & tile_field) {
+		writer.write_signed_varbits(state.tile.x - baseline->tile.x);
+		writer.write_signed_varbits(state.tile.y - baseline->tile.y);
+	}
+	// each tile is usually next to the one before it, so it is written relative to it
+	if (fields & path_field) {
+		writer.write(state.path_size, path_size_bits);
+		no::vector2i previous = state.tile;
+		for (int i = 0; i < state.path_size; i++) {
+			writer.write_signed_varbits(state.path[i].x - previous.x);
+			writer.write_signed_varbits(state.path[i].y - previous.y);
+			previous = state.path[i];
+		}
+	}
+	if (fields & rotation_field) {
+		writer.write(state.rotation, 8);
+	}
+	if (fields & health_field) {
+		writer.write_signed_varbits(state.health - baseline->health);
+	}
+}
+
+}
+
+std::vector<replication_receiver::change> replication_receiver::receive(uint32_t sequence, const std::vector<uint8_t>& bits) {
+	bit_reader reader{ bits };
+	std::vector<change> received;
+	int count = (int)reader.read(replication::count_bits);
+	for (int i = 0; i < count && !reader.is_overflowed(); i++) {
+		int instance_id = (int)reader.read_varbits();
+		uint32_t baseline_age = reader.read_varbits();
+		auto& history = states[instance_id];
+		replicated_state baseline;
+		if (baseline_age > 0) {
+			uint32_t baseline_sequence = sequence - baseline_age;
+			auto found = std::find_if(history.begin(), history.end(), [baseline_sequence](const received_state& state) {
+				return state.sequence == baseline_sequence;
+			});
+			if (found == history.end()) {
+				WARNING("Missing baseline " << baseline_sequence << " for " << instance_id);
+			} else {
+				baseline = found->state;
+				// older states will not be used as baselines again
+				history.erase(history.begin(), found);
+			}
+		}
+		replicated_state state = baseline;
+		state.instance_id = instance_id;
+		uint32_t fields = reader.read(field_bits);
+		if (fields & tile_field) {
+			state.tile.x = baseline.tile.x + reader.read_signed_varbits();
+			state.tile.y = baseline.tile.y + reader.read_signed_varbits();
+		}
+		if (fields & path_field) {
+			state.path_size = std::min((int)reader.read(path_size_bits), replicated_state::max_path_size);
+			no::vector2i previous = state.tile;
+			for (int i = 0; i < state.path_size; i++) {
+				state.path[i].x = previous.x + reader.read_signed_varbits();
+				state.path[i].y = previous.y + reader.read_signed_varbits();
+				previous = state.path[i];
+			}
+		}
+		if (fields & rotation_field) {
+			state.rotation = (uint8_t)reader.read(8);
+		}
+		if (fields & health_field) {
+			state.health = baseline.health + reader.read_signed_varbits();
+		}
+		if (reader.is_overflowed()) {
+			break;
+		}
+		auto& received_change = received.emplace_back();
+		received_change.state = state;
+		if (!history.empty()) {
+			received_change.previous = history.back().state;
+		}
+		history.push_back({ sequence, state });
+		// a baseline is at most this old, and the character is in each update at most once
+		if (history.size() > replication::max_baseline_age + 1) {
+			history.erase(history.begin());
+		}
+	}
+	if (reader.is_overflowed()) {
+		WARNING("Update " << sequence << " is cut short");
+	}
+	return received;
+}
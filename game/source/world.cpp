@@ -2,6 +2,13 @@
 #include "assets.hpp"
 #include "pathfinding.hpp"
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+# include <emmintrin.h>
+# define ENABLE_SSE2_TERRAIN_KERNEL 1
+#else
+# define ENABLE_SSE2_TERRAIN_KERNEL 0
+#endif
+
 void world_tile::set(uint8_t type) {
 	set_corner(0, type);
 	set_corner(1, type);
@@ -57,6 +64,7 @@ float world_tile::pick_height() const {
 }
 
 world_autotiler::world_autotiler() {
+	uv_indices.insert(uv_indices.begin(), table_size, 0);
 	add_main(world_tile::grass);
 	add_main(world_tile::dirt);
 	add_main(world_tile::stone);
@@ -76,37 +84,55 @@ world_autotiler::world_autotiler() {
 }
 
 void world_autotiler::add_main(uint8_t tile) {
-	uv_indices[packed_corners(tile, tile, tile, tile)] = { tile, 0 };
+	set(packed_corners(tile, tile, tile, tile), { tile, 0 });
 }
 
 void world_autotiler::add_group(uint8_t primary, uint8_t secondary) {
-	uv_indices[packed_corners(primary, primary, primary, secondary)] = { 0, row };
-	uv_indices[packed_corners(primary, primary, secondary, primary)] = { 1, row };
-	uv_indices[packed_corners(primary, secondary, secondary, primary)] = { 2, row };
-	uv_indices[packed_corners(secondary, primary, primary, secondary)] = { 3, row };
-	uv_indices[packed_corners(secondary, secondary, secondary, primary)] = { 4, row };
-	uv_indices[packed_corners(secondary, secondary, primary, primary)] = { 5, row };
-	uv_indices[packed_corners(secondary, secondary, primary, secondary)] = { 6, row };
-	uv_indices[packed_corners(secondary, primary, secondary, primary)] = { 7, row };
+	set(packed_corners(primary, primary, primary, secondary), { 0, row });
+	set(packed_corners(primary, primary, secondary, primary), { 1, row });
+	set(packed_corners(primary, secondary, secondary, primary), { 2, row });
+	set(packed_corners(secondary, primary, primary, secondary), { 3, row });
+	set(packed_corners(secondary, secondary, secondary, primary), { 4, row });
+	set(packed_corners(secondary, secondary, primary, primary), { 5, row });
+	set(packed_corners(secondary, secondary, primary, secondary), { 6, row });
+	set(packed_corners(secondary, primary, secondary, primary), { 7, row });
 	row++;
-	uv_indices[packed_corners(primary, secondary, primary, primary)] = { 0, row };
-	uv_indices[packed_corners(secondary, primary, primary, primary)] = { 1, row };
-	uv_indices[packed_corners(secondary, primary, primary, secondary)] = { 2, row };
-	uv_indices[packed_corners(primary, secondary, secondary, primary)] = { 3, row };
-	uv_indices[packed_corners(secondary, primary, secondary, secondary)] = { 4, row };
-	uv_indices[packed_corners(primary, primary, secondary, secondary)] = { 5, row };
-	uv_indices[packed_corners(primary, secondary, secondary, secondary)] = { 6, row };
-	uv_indices[packed_corners(primary, secondary, primary, secondary)] = { 7, row };
+	set(packed_corners(primary, secondary, primary, primary), { 0, row });
+	set(packed_corners(secondary, primary, primary, primary), { 1, row });
+	set(packed_corners(secondary, primary, primary, secondary), { 2, row });
+	set(packed_corners(primary, secondary, secondary, primary), { 3, row });
+	set(packed_corners(secondary, primary, secondary, secondary), { 4, row });
+	set(packed_corners(primary, primary, secondary, secondary), { 5, row });
+	set(packed_corners(primary, secondary, secondary, secondary), { 6, row });
+	set(packed_corners(primary, secondary, primary, secondary), { 7, row });
 	row++;
 }
 
+int world_autotiler::table_index(uint8_t top_left, uint8_t top_right, uint8_t bottom_left, uint8_t bottom_right) const {
+	if ((top_left | top_right | bottom_left | bottom_right) >= types_in_table) {
+		return -1;
+	}
+	return (top_left << (bits_per_corner * 3)) + (top_right << (bits_per_corner * 2)) + (bottom_left << bits_per_corner) + bottom_right;
+}
+
+void world_autotiler::set(uint32_t corners, no::vector2i uv) {
+	int index = table_index(corners >> 24, (corners >> 16) & 0xFF, (corners >> 8) & 0xFF, corners & 0xFF);
+	ASSERT(index != -1);
+	uv_indices[index] = uv;
+}
+
 uint32_t world_autotiler::packed_corners(uint8_t top_left, uint8_t top_right, uint8_t bottom_left, uint8_t bottom_right) const {
 	return (top_left << 24) + (top_right << 16) + (bottom_left << 8) + bottom_right;
 }
 
 no::vector2i world_autotiler::uv_index(uint32_t corners) const {
-	auto it = uv_indices.find(corners);
-	return it != uv_indices.end() ? it->second : 0;
+	int index = table_index(corners >> 24, (corners >> 16) & 0xFF, (corners >> 8) & 0xFF, corners & 0xFF);
+	return index != -1 ? uv_indices[index] : 0;
+}
+
+no::vector2i world_autotiler::uv_index(const world_tile& tile) const {
+	int index = table_index(tile.corner(0), tile.corner(1), tile.corner(2), tile.corner(3));
+	return index != -1 ? uv_indices[index] : 0;
 }
 
 world_terrain::world_terrain(world_state& world) : world(world) {
@@ -126,6 +152,10 @@ bool world_terrain::is_out_of_bounds(no::vector2i tile) const {
 	return false;
 }
 
+bool world_terrain::is_out_of_local_bounds(no::vector2i tile) const {
+	return tile.x < 0 || tile.y < 0 || tile.x >= size().x || tile.y >= size().y;
+}
+
 float world_terrain::elevation_at(no::vector2i tile) const {
 	if (is_out_of_bounds(tile)) {
 		return 0.0f;
@@ -134,7 +164,7 @@ float world_terrain::elevation_at(no::vector2i tile) const {
 }
 
 float world_terrain::local_elevation_at(no::vector2i tile) const {
-	if (is_out_of_bounds(tile)) {
+	if (is_out_of_local_bounds(tile)) {
 		return 0.0f;
 	}
 	return local_tile_at(tile).height;
@@ -244,6 +274,9 @@ void world_terrain::set_tile_flag(no::vector2i tile, int flag, bool value) {
 	if (!is_out_of_bounds(tile)) {
 		tile_at(tile).set_flag(flag, value);
 		chunk_at_tile(tile).dirty = true;
+		if (flag == world_tile::solid_flag) {
+			changes++;
+		}
 	}
 }
 
@@ -334,11 +367,63 @@ no::vector3f world_terrain::calculate_normal(no::vector2i tile) const {
 	return a_to_c.cross(b_to_d).normalized();
 }
 
+void world_terrain::calculate_chunk_normals(int index, std::vector<no::vector3f>& normals) const {
+	const int grid = world_tile_chunk::width + 1;
+	const int padded = grid + 2;
+	const int begin_x = (index % 3) * world_tile_chunk::width - 1;
+	const int begin_y = (index / 3) * world_tile_chunk::width - 1;
+	// gather the heights once, with a border of one tile. tiles outside the terrain have zero height.
+	std::vector<float> heights;
+	heights.insert(heights.begin(), padded * padded, 0.0f);
+	for (int y = 0; y < padded; y++) {
+		const int ly = begin_y + y;
+		if (ly < 0 || ly >= size().y) {
+			continue;
+		}
+		const int first_x = std::max(0, -begin_x);
+		const int last_x = std::min(padded, size().x - begin_x);
+		float* row = &heights[y * padded];
+		for (int x = first_x; x < last_x; x++) {
+			row[x] = local_tile_at({ begin_x + x, ly }).height;
+		}
+	}
+	normals.resize(grid * grid);
+	for (int y = 0; y < grid; y++) {
+		const float* up = &heights[y * padded + 1];
+		const float* middle = &heights[(y + 1) * padded];
+		const float* down = &heights[(y + 2) * padded + 1];
+		no::vector3f* out = &normals[y * grid];
+		int x = 0;
+#if ENABLE_SSE2_TERRAIN_KERNEL
+		const __m128 normal_y = _mm_set1_ps(1.5f);
+		const __m128 normal_y_squared = _mm_set1_ps(1.5f * 1.5f);
+		alignas(16) float nx[4];
+		alignas(16) float ny[4];
+		alignas(16) float nz[4];
+		for (; x + 4 <= grid; x += 4) {
+			__m128 dx = _mm_sub_ps(_mm_loadu_ps(middle + x), _mm_loadu_ps(middle + x + 2));
+			__m128 dz = _mm_sub_ps(_mm_loadu_ps(down + x), _mm_loadu_ps(up + x));
+			__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz)), normal_y_squared));
+			_mm_store_ps(nx, _mm_div_ps(dx, length));
+			_mm_store_ps(ny, _mm_div_ps(normal_y, length));
+			_mm_store_ps(nz, _mm_div_ps(dz, length));
+			for (int i = 0; i < 4; i++) {
+				out[x + i] = { nx[i], ny[i], nz[i] };
+			}
+		}
+#endif
+		for (; x < grid; x++) {
+			out[x] = no::vector3f{ middle[x] - middle[x + 2], 1.5f, down[x] - up[x] }.normalized();
+		}
+	}
+}
+
 void world_terrain::load_chunk(no::vector2i chunk_index, int index) {
 	auto& chunk = chunks[index];
 	no::io_stream stream;
 	no::file::read(chunk_path(chunk_index), stream);
 	chunk.dirty = true;
+	changes++;
 	chunk.offset = chunk_index * world_tile_chunk::width;
 	chunk.water_areas.clear();
 	if (stream.size_left_to_read() > 0) {
@@ -565,22 +650,32 @@ std::string world_terrain::chunk_path(no::vector2i index) const {
 	return no::asset_path("worlds/" + world.name + "_" + std::to_string(index.x) + "_" + std::to_string(index.y) + ".ec");
 }
 
-world_state::world_state() : terrain(*this), objects(*this) {
-	
+world_state::world_state() : terrain(*this), objects(*this), paths(*this) {
+	objects.events.remove.listen([this](const game_object& object) {
+		paths.cancel_requester(object.instance_id);
+	});
 }
 
 void world_state::update() {
+	paths.update();
 	objects.update();
 }
 
 std::vector<no::vector2i> world_state::path_between(no::vector2i from, no::vector2i to) const {
-	return pathfinder{ terrain }.find_path(from, to);
+	return pathfinder{ *walkable_tiles() }.find_path(from, to);
 }
 
 bool world_state::can_fish_at(no::vector2i from, no::vector2i to) const {
 	return terrain.tile_at(to).is_water() && from.distance_to(to) < 15;
 }
 
+std::shared_ptr<const walkable_grid> world_state::walkable_tiles() const {
+	if (!walkable_snapshot || walkable_snapshot->revision() != terrain.revision()) {
+		walkable_snapshot = std::make_shared<walkable_grid>(terrain);
+	}
+	return walkable_snapshot;
+}
+
 no::vector2i world_position_to_tile_index(float x, float z) {
 	return { (int)std::floor(x), (int)std::floor(z) };
 }
@@ -22,7 +22,7 @@ int world_objects::add(int definition_id) {
 		objects.push_back(object);
 	}
 	if (object.definition().type == game_object_type::character) {
-		characters.emplace_back(object.instance_id);
+		add_character(object.instance_id);
 	}
 	events.add.emit(object);
 	return object.instance_id;
@@ -46,7 +46,8 @@ int world_objects::add(no::io_stream& stream) {
 		}
 	}
 	if (object.definition().type == game_object_type::character) {
-		characters.emplace_back(object.instance_id).read(stream);
+		add_character(object.instance_id);
+		characters.back().read(stream);
 	}
 	events.add.emit(object);
 	return object.instance_id;
@@ -61,21 +62,17 @@ const game_object& world_objects::object(int instance_id) const {
 }
 
 character_object* world_objects::character(int instance_id) {
-	for (auto& character : characters) {
-		if (character.object_id == instance_id) {
-			return &character;
-		}
+	if (instance_id < 0 || instance_id >= (int)character_indices.size() || character_indices[instance_id] == -1) {
+		return nullptr;
 	}
-	return nullptr;
+	return &characters[character_indices[instance_id]];
 }
 
 const character_object* world_objects::character(int instance_id) const {
-	for (auto& character : characters) {
-		if (character.object_id == instance_id) {
-			return &character;
-		}
+	if (instance_id < 0 || instance_id >= (int)character_indices.size() || character_indices[instance_id] == -1) {
+		return nullptr;
 	}
-	return nullptr;
+	return &characters[character_indices[instance_id]];
 }
 
 void world_objects::remove(int instance_id) {
@@ -84,12 +81,17 @@ void world_objects::remove(int instance_id) {
 	}
 	events.remove.emit(objects[instance_id]);
 	objects[instance_id] = {};
-	for (int i = 0; i < (int)characters.size(); i++) {
-		if (characters[i].object_id == instance_id) {
-			characters.erase(characters.begin() + i);
-			break;
-		}
+	if (instance_id >= (int)character_indices.size() || character_indices[instance_id] == -1) {
+		return;
+	}
+	// the last character takes the place of the removed one, so only one index has to be updated
+	int index = character_indices[instance_id];
+	if (index != (int)characters.size() - 1) {
+		characters[index] = std::move(characters.back());
+		character_indices[characters[index].object_id] = index;
 	}
+	characters.pop_back();
+	character_indices[instance_id] = -1;
 }
 
 void world_objects::for_each(const std::function<void(game_object*)>& handler) {
@@ -116,6 +118,14 @@ void world_objects::update() {
 	}
 }
 
+void world_objects::add_character(int instance_id) {
+	if (instance_id >= (int)character_indices.size()) {
+		character_indices.resize(instance_id + 1, -1);
+	}
+	character_indices[instance_id] = (int)characters.size();
+	characters.emplace_back(instance_id);
+}
+
 int world_objects::count() const {
 	return (int)objects.size();
 }
@@ -4,7 +4,7 @@ namespace config {
 
 const std::string host = "localhost";
 const int port = 7524;
-const int max_clients = 100;
+const int max_clients = 10000; // client slots are made as they are needed. each connection has a 16 KiB receive buffer
 const int save_interval_seconds = 120;
 
 namespace database {
@@ -15,6 +15,10 @@ const std::string password = "einheri";
 const std::string host = "localhost";
 const int port = 5432;
 
+// store players in a local file instead, so no postgresql server is needed
+const bool use_local_store = false;
+const std::string local_store_path = "players.store";
+
 }
 
 }
@@ -0,0 +1,78 @@
+#include "backend_worker.hpp"
+
+backend_worker::backend_worker(persistence_backend& backend) : backend(backend) {
+	thread = std::thread{ &backend_worker::run, this };
+}
+
+backend_worker::~backend_worker() {
+	{
+		std::lock_guard lock{ mutex };
+		stopping = true;
+	}
+	wake.notify_one();
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+void backend_worker::queue(const work& work) {
+	{
+		std::lock_guard lock{ mutex };
+		queued.push_back(work);
+	}
+	unfinished_count++;
+	wake.notify_one();
+}
+
+void backend_worker::complete() {
+	{
+		std::lock_guard lock{ mutex };
+		std::swap(finished, completing);
+	}
+	for (auto& continuation : completing) {
+		unfinished_count--;
+		if (continuation) {
+			continuation();
+		}
+	}
+	completing.clear();
+}
+
+void backend_worker::wait() {
+	while (unfinished_count > 0) {
+		{
+			std::unique_lock lock{ mutex };
+			finished_work.wait(lock, [this] {
+				return !finished.empty();
+			});
+		}
+		complete();
+	}
+}
+
+int backend_worker::unfinished() const {
+	return unfinished_count;
+}
+
+void backend_worker::run() {
+	while (true) {
+		work next;
+		{
+			std::unique_lock lock{ mutex };
+			wake.wait(lock, [this] {
+				return stopping || !queued.empty();
+			});
+			if (queued.empty()) {
+				return;
+			}
+			next = std::move(queued.front());
+			queued.pop_front();
+		}
+		auto continuation = next(backend);
+		{
+			std::lock_guard lock{ mutex };
+			finished.push_back(std::move(continuation));
+		}
+		finished_work.notify_one();
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "persistency.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// uses the persistence backend on its own thread, so the tick does not wait for the database.
+// work is done in the order it is queued, so a load queued after a write sees what was written.
+// once the worker is made, the backend must only be used through it.
+class backend_worker {
+public:
+
+	// called on the main thread in complete(), after the work is done
+	using continuation = std::function<void()>;
+	using work = std::function<continuation(persistence_backend&)>;
+
+	backend_worker(persistence_backend& backend);
+	backend_worker(const backend_worker&) = delete;
+	backend_worker(backend_worker&&) = delete;
+
+	// finishes the queued work, but does not call the continuations
+	~backend_worker();
+
+	backend_worker& operator=(const backend_worker&) = delete;
+	backend_worker& operator=(backend_worker&&) = delete;
+
+	// must be called from the main thread
+	void queue(const work& work);
+
+	// done is called with the result of the work on the main thread
+	template<typename Work, typename Done>
+	void queue(const Work& work, const Done& done) {
+		queue(backend_worker::work{ [work, done](persistence_backend& backend) -> continuation {
+			auto result = work(backend);
+			return [done, result]() mutable {
+				done(result);
+			};
+		} });
+	}
+
+	// calls the continuations of finished work
+	void complete();
+
+	// blocks until all the queued work is done and completed, including work queued by continuations
+	void wait();
+
+	int unfinished() const;
+
+private:
+
+	void run();
+
+	persistence_backend& backend;
+	std::thread thread;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable finished_work;
+	std::deque<work> queued;
+	std::vector<continuation> finished;
+	std::vector<continuation> completing;
+	bool stopping = false;
+
+	int unfinished_count = 0; // only used on the main thread
+
+};
@@ -0,0 +1,88 @@
+#include "client_registry.hpp"
+
+static int find_index(const std::unordered_map<int, int>& indices, int key) {
+	auto index = indices.find(key);
+	return index != indices.end() ? index->second : -1;
+}
+
+client_state& client_registry::operator[](int client_index) {
+	return clients[client_index];
+}
+
+const client_state& client_registry::operator[](int client_index) const {
+	return clients[client_index];
+}
+
+int client_registry::add(int socket_id) {
+	int client_index = -1;
+	if (free_indices.empty()) {
+		client_index = (int)clients.size();
+		clients.emplace_back();
+	} else {
+		client_index = free_indices.back();
+		free_indices.pop_back();
+	}
+	auto& client = clients[client_index];
+	client = { true };
+	client.socket_id = socket_id;
+	client.session = next_session++;
+	by_socket[socket_id] = client_index;
+	connected_count++;
+	return client_index;
+}
+
+void client_registry::remove(int client_index) {
+	auto& client = clients[client_index];
+	if (!client.is_connected()) {
+		return;
+	}
+	by_socket.erase(client.socket_id);
+	set_player(client_index, -1);
+	set_account(client_index, "");
+	client = { false };
+	free_indices.push_back(client_index);
+	connected_count--;
+}
+
+int client_registry::client_with_socket(int socket_id) const {
+	return find_index(by_socket, socket_id);
+}
+
+int client_registry::client_with_player(int player_instance_id) const {
+	return find_index(by_player, player_instance_id);
+}
+
+int client_registry::client_with_account(const std::string& email) const {
+	auto index = by_account.find(email);
+	return index != by_account.end() ? index->second : -1;
+}
+
+void client_registry::set_player(int client_index, int player_instance_id) {
+	auto& client = clients[client_index];
+	if (client.object.player_instance_id != -1) {
+		by_player.erase(client.object.player_instance_id);
+	}
+	client.object.player_instance_id = player_instance_id;
+	if (player_instance_id != -1) {
+		by_player[player_instance_id] = client_index;
+	}
+}
+
+void client_registry::set_account(int client_index, const std::string& email) {
+	auto& client = clients[client_index];
+	if (!client.account.email.empty()) {
+		by_account.erase(client.account.email);
+	}
+	client.account.email = email;
+	if (!email.empty()) {
+		by_account[email] = client_index;
+	}
+}
+
+bool client_registry::is_session(int client_index, int session) const {
+	return client_index >= 0 && client_index < (int)clients.size() && clients[client_index].is_connected() && clients[client_index].session == session;
+}
+
+int client_registry::count() const {
+	return connected_count;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "gamevar.hpp"
+#include "quest.hpp"
+#include "script.hpp"
+#include "network.hpp"
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class client_state {
+public:
+
+	bool connected = false;
+	int socket_id = -1;
+	long long save_timer = -1;
+
+	// a client index is reused by the next connection, so backend continuations check the session
+	int session = -1;
+
+	// waiting for the backend. packets that need it again are ignored until it is done.
+	bool is_loading = false;
+
+	// entered the world this tick. the other clients are told at the end of the tick.
+	bool is_joining = false;
+
+	int sent_trade_request_to_player_id = -1;
+
+	// set with client_registry::set_account(), so the client can be found by it
+	struct {
+		std::string email;
+	} account;
+
+	struct {
+		int id = -1;
+		std::string display_name;
+		game_variable_map variables;
+		quest_instance_list quests;
+	} player;
+
+	// set with client_registry::set_player(), so the client can be found by it
+	struct {
+		int player_instance_id = -1;
+	} object;
+
+	script_tree* dialogue = nullptr;
+
+	client_state() = default;
+	client_state(bool connected) : connected(connected) {}
+	client_state(const client_state&) = delete;
+	client_state(client_state&&) = default;
+
+	client_state& operator=(const client_state&) = delete;
+	client_state& operator=(client_state&&) = default;
+
+	bool is_connected() const {
+		return connected;
+	}
+
+};
+
+// clients are kept in slots that are reused after they disconnect, and grow with the number of clients.
+// a client index stays the same while the client is connected, and the socket id is only used to reach it.
+// the slots never move, so pointers into a client stay valid while it is connected.
+class client_registry {
+public:
+
+	client_registry() = default;
+	client_registry(const client_registry&) = delete;
+	client_registry(client_registry&&) = delete;
+
+	~client_registry() = default;
+
+	client_registry& operator=(const client_registry&) = delete;
+	client_registry& operator=(client_registry&&) = delete;
+
+	client_state& operator[](int client_index);
+	const client_state& operator[](int client_index) const;
+
+	// returns the client index
+	int add(int socket_id);
+	void remove(int client_index);
+
+	// -1 if there is no such client
+	int client_with_socket(int socket_id) const;
+	int client_with_player(int player_instance_id) const;
+	int client_with_account(const std::string& email) const;
+
+	void set_player(int client_index, int player_instance_id);
+	void set_account(int client_index, const std::string& email);
+
+	bool is_session(int client_index, int session) const;
+	int count() const;
+
+	template<typename F>
+	void for_each(const F& function) {
+		for (int i = 0; i < (int)clients.size(); i++) {
+			if (clients[i].is_connected()) {
+				function(i, clients[i]);
+			}
+		}
+	}
+
+	template<typename P>
+	void send(int client_index, const P& packet) const {
+		no::send_packet(clients[client_index].socket_id, packet);
+	}
+
+	template<typename P>
+	void broadcast(const P& packet, int except_client_index) const {
+		no::broadcast(packet, clients[except_client_index].socket_id);
+	}
+
+private:
+
+	std::deque<client_state> clients;
+	std::vector<int> free_indices;
+	std::unordered_map<int, int> by_socket;
+	std::unordered_map<int, int> by_player;
+	std::unordered_map<std::string, int> by_account;
+	int connected_count = 0;
+	int next_session = 0;
+
+};
@@ -3,13 +3,11 @@
 #include "character.hpp"
 #include "pathfinding.hpp"
 
+#include <algorithm>
+
 active_combat::active_combat(int attacker_id, int target_id, server_world& world) :
 	attacker_id(attacker_id), target_id(target_id), world(&world) {
-	last_hit.start();
-}
 
-bool active_combat::can_hit()const {
-	return last_hit.milliseconds() > 2000;
 }
 
 bool active_combat::is_target_in_range() const {
@@ -25,7 +23,6 @@ bool active_combat::is_target_in_range() const {
 int active_combat::hit() {
 	auto attacker = world->objects.character(attacker_id);
 	auto target = world->objects.character(target_id);
-	last_hit.start();
 	int accuracy = 1 + attacker->equipment.accuracy();
 	int power = 1 + attacker->equipment.power();
 	int protection = 1 + target->equipment.protection();
@@ -70,7 +67,7 @@ void active_combat::update_movement() {
 	auto& target_object = world->objects.object(target_id);
 	auto attacker = world->objects.character(attacker_id);
 	auto target = world->objects.character(target_id);
-	if (!attacker->target_path.empty()) {
+	if (!attacker->target_path.empty() || world->paths.has_request(attacker_id)) {
 		return;
 	}
 	std::vector<no::vector2i> path;
@@ -95,13 +92,26 @@ void active_combat::update_movement() {
 			path.emplace_back(target_tile - delta);
 		}
 	} else {
-		path = world->path_between(attacker_object.tile(), target_tile);
-		for (int i = 0; i < 2 && !path.empty(); i++) {
-			path.erase(path.begin());
-		}
+		world->paths.request(attacker_id, attacker_object.tile(), target_tile, server_world::combat_priority, [world = world, attacker_id = attacker_id](std::vector<no::vector2i>& path) {
+			auto attacker = world->objects.character(attacker_id);
+			if (!attacker || !world->combat.is_in_combat(attacker_id)) {
+				return;
+			}
+			if (path.empty()) {
+				// nothing moves if the target can't be reached, so try again in a while
+				world->timers.schedule(no::updates_per_second(), [world, attacker_id] {
+					world->combat.character_moved(attacker_id);
+				});
+				return;
+			}
+			for (int i = 0; i < 2 && !path.empty(); i++) {
+				path.erase(path.begin());
+			}
+			attacker->target_path = path;
+		});
+		return;
 	}
 	attacker->target_path = path;
-	world->events.move.emplace_and_push(attacker_id, path);
 }
 
 combat_system::combat_system(server_world& world) : world{ world } {
@@ -114,47 +124,115 @@ combat_system::~combat_system() {
 	world.objects.events.remove.ignore(object_remove_event);
 }
 
-void combat_system::update() {
-	for (auto& combat : combats) {
-		combat.update_movement();
-		if (combat.can_hit()) {
-			auto target = world.objects.character(combat.target_id);
-			if (target->stat(stat_type::health).effective() < 1) {
-				continue;
+void combat_system::add(int attacker_id, int target_id) {
+	ASSERT(attacker_id != -1);
+	ASSERT(target_id != -1);
+	if (auto attacker = combats_by_object.find(attacker_id); attacker != combats_by_object.end()) {
+		for (int combat_id : attacker->second) {
+			if (combats.find(combat_id)->second.attacker_id == attacker_id) {
+				return;
 			}
-			if (combat.is_target_in_range()) {
-				events.hit.emit(combat.attacker_id, combat.target_id, combat.hit());
-				combat.next_turn();
+		}
+	}
+	if (auto target = combats_by_object.find(target_id); target != combats_by_object.end()) {
+		for (int combat_id : target->second) {
+			if (combats.find(combat_id)->second.target_id == target_id) {
+				return;
 			}
 		}
 	}
+	int combat_id = next_combat_id++;
+	combats.emplace(combat_id, active_combat{ attacker_id, target_id, world });
+	combats_by_object[attacker_id].push_back(combat_id);
+	combats_by_object[target_id].push_back(combat_id);
+	schedule_hit(combat_id, hit_interval_seconds * no::updates_per_second());
+	combats.find(combat_id)->second.update_movement();
 }
 
-void combat_system::add(int attacker_id, int target_id) {
-	ASSERT(attacker_id != -1);
-	ASSERT(target_id != -1);
-	for (auto& combat : combats) {
-		if (combat.attacker_id == attacker_id || combat.target_id == target_id) {
-			return;
-		}
+void combat_system::stop_all(int object_id) {
+	auto object = combats_by_object.find(object_id);
+	if (object == combats_by_object.end()) {
+		return;
+	}
+	std::vector<int> stopping = object->second;
+	for (int combat_id : stopping) {
+		remove(combat_id);
 	}
-	combats.emplace_back(attacker_id, target_id, world);
 }
 
-void combat_system::stop_all(int object_id) {
-	for (int i = 0; i < (int)combats.size(); i++) {
-		if (combats[i].attacker_id == object_id || combats[i].target_id == object_id) {
-			combats.erase(combats.begin() + i);
-			i--;
+bool combat_system::is_in_combat(int object_id) const {
+	return combats_by_object.find(object_id) != combats_by_object.end();
+}
+
+int combat_system::count() const {
+	return (int)combats.size();
+}
+
+void combat_system::character_moved(int object_id) {
+	auto object = combats_by_object.find(object_id);
+	if (object == combats_by_object.end()) {
+		return;
+	}
+	// a hit can end the combat, so the list is copied first
+	std::vector<int> moved_in = object->second;
+	for (int combat_id : moved_in) {
+		auto combat = combats.find(combat_id);
+		if (combat == combats.end()) {
+			continue;
+		}
+		if (combat->second.waiting_for_range && combat->second.is_target_in_range()) {
+			try_hit(combat_id);
+		} else {
+			combat->second.update_movement();
 		}
 	}
 }
 
-bool combat_system::is_in_combat(int object_id) const {
-	for (auto& combat : combats) {
-		if (combat.attacker_id == object_id || combat.target_id == object_id) {
-			return true;
+void combat_system::schedule_hit(int combat_id, long long ticks) {
+	combats.find(combat_id)->second.hit_timer = world.timers.schedule(ticks, [this, combat_id] {
+		try_hit(combat_id);
+	});
+}
+
+void combat_system::try_hit(int combat_id) {
+	auto found = combats.find(combat_id);
+	if (found == combats.end()) {
+		return;
+	}
+	auto& combat = found->second;
+	combat.waiting_for_range = false;
+	auto target = world.objects.character(combat.target_id);
+	if (target->stat(stat_type::health).effective() < 1) {
+		schedule_hit(combat_id, 1); // the kill is handled after this update
+		return;
+	}
+	if (!combat.is_target_in_range()) {
+		combat.waiting_for_range = true;
+		combat.update_movement();
+		return;
+	}
+	events.hit.emit(combat.attacker_id, combat.target_id, combat.hit());
+	combat.next_turn();
+	schedule_hit(combat_id, hit_interval_seconds * no::updates_per_second());
+	combat.update_movement();
+}
+
+void combat_system::remove(int combat_id) {
+	auto combat = combats.find(combat_id);
+	if (combat == combats.end()) {
+		return;
+	}
+	world.timers.cancel(combat->second.hit_timer);
+	for (int object_id : { combat->second.attacker_id, combat->second.target_id }) {
+		auto object = combats_by_object.find(object_id);
+		if (object == combats_by_object.end()) {
+			continue; // fighting itself
+		}
+		auto& ids = object->second;
+		ids.erase(std::remove(ids.begin(), ids.end(), combat_id), ids.end());
+		if (ids.empty()) {
+			combats_by_object.erase(object);
 		}
 	}
-	return false;
+	combats.erase(combat);
 }
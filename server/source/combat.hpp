@@ -1,9 +1,10 @@
 #pragma once
 
 #include "event.hpp"
-#include "timer.hpp"
 #include "math.hpp"
 
+#include <unordered_map>
+
 class server_world;
 class character_object;
 
@@ -12,10 +13,11 @@ public:
 
 	int attacker_id = -1;
 	int target_id = -1;
+	long long hit_timer = -1;
+	bool waiting_for_range = false; // the hit is due, but waits until one of them moves into range
 
 	active_combat(int attacker_id, int target_id, server_world& world);
 
-	bool can_hit() const;
 	bool is_target_in_range() const;
 	int hit();
 	void next_turn();
@@ -24,14 +26,17 @@ public:
 private:
 
 	server_world* world = nullptr;
-	no::timer last_hit;
 	no::random_number_generator random;
 
 };
 
+// combats are found by the ids of both participants, so looking up a character's combats does not scan every combat.
+// hits are scheduled on the world timers, and range and chasing are only looked at again when a participant moves.
 class combat_system {
 public:
 
+	static const int hit_interval_seconds = 2;
+
 	struct hit_event {
 		int attacker_id = -1;
 		int target_id = -1;
@@ -51,15 +56,31 @@ public:
 	combat_system& operator=(const combat_system&) = delete;
 	combat_system& operator=(combat_system&&) = delete;
 
-	void update();
 	void add(int attacker_id, int target_id);
 
 	void stop_all(int object_id);
 	bool is_in_combat(int object_id) const;
+	int count() const;
+
+	template<typename F>
+	void for_each(const F& function) const {
+		for (auto& combat : combats) {
+			function(combat.second);
+		}
+	}
+
+	// called when the character has moved to another tile or stopped, and when a chase should be tried again
+	void character_moved(int object_id);
 
 private:
 
-	std::vector<active_combat> combats;
+	void schedule_hit(int combat_id, long long ticks);
+	void try_hit(int combat_id);
+	void remove(int combat_id);
+
+	std::unordered_map<int, active_combat> combats;
+	std::unordered_map<int, std::vector<int>> combats_by_object;
+	int next_combat_id = 0;
 	server_world& world;
 	int object_remove_event = -1;
 
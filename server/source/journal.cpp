@@ -0,0 +1,85 @@
+#include "journal.hpp"
+
+player_change::field_key player_change::key() const {
+	switch (type) {
+	case field::item:
+	case field::quest_task:
+		return { type, values[0], values[1], "" };
+	case field::stat:
+		return { type, values[0], 0, "" };
+	case field::variable:
+		return { type, values[0], 0, name };
+	default:
+		return { type, 0, 0, "" };
+	}
+}
+
+player_change::field_key player_change::key() const {
+	switch (type) {
+	case field::item:
+	case field::quest_task:
+		return { type, values[0], values[1], "" };
+	case field::stat:
+		return { type, values[0], 0, "" };
+	case field::variable:
+		return { type, values[0], 0, name };
+	default:
+		return { type, 0, 0, "" };
+	}
+}
+
+void player_change::write(no::io_stream& stream) const {
+	stream.write((uint8_t)type);
+	stream.write((int32_t)player_id);
+	for (int value : values) {
+		stream.write((int32_t)value);
+	}
+	stream.write(name);
+	stream.write(value);
+}
+
+void player_change::read(no::io_stream& stream) {
+	type = (field)stream.read<uint8_t>();
+	player_id = stream.read<int32_t>();
+	for (int& value : values) {
+		value = stream.read<int32_t>();
+	}
+	name = stream.read<std::string>();
+	value = stream.read<std::string>();
+}
+
+player_journal::player_journal(const std::string& path) : log{ path } {
+
+}
+
+void player_journal::append(const player_change& change) {
+	no::io_stream record;
+	change.write(record);
+	log.append(record);
+}
+
+void player_journal::flush() {
+	log.flush(true);
+}
+
+std::vector<player_change> player_journal::read() const {
+	std::vector<player_change> changes;
+	log.read([&](no::io_stream& record) {
+		changes.emplace_back().read(record);
+	});
+	return changes;
+}
+
+void player_journal::rewrite(const std::vector<player_change>& changes) {
+	no::io_stream records;
+	for (auto& change : changes) {
+		no::io_stream record;
+		change.write(record);
+		record_log::write_record(records, record);
+	}
+	log.rewrite(records);
+}
+
+size_t player_journal::size() const {
+	return log.size();
+}
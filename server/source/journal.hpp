@@ -0,0 +1,61 @@
+#pragma once
+
+#include "record_log.hpp"
+
+#include <string>
+#include <tuple>
+#include <vector>
+
+// a change to what is stored for a player. a change sets a field, so replaying it more than once gives the same result.
+struct player_change {
+
+	enum class field : uint8_t { tile, item, stat, variable, quest_task };
+
+	// changes with the same key set the same field, so only the newest one matters
+	using field_key = std::tuple<field, int, int, std::string>;
+
+	field type = field::tile;
+	int player_id = -1;
+
+	// tile: x, z. item: container, slot, item, stack. stat: stat, experience.
+	// variable: scope, type. quest task: quest, task, progress.
+	int values[4] = {};
+	std::string name;
+	std::string value;
+
+	field_key key() const;
+
+	void write(no::io_stream& stream) const;
+	void read(no::io_stream& stream);
+
+};
+
+// local file of player changes that are not yet written to the database.
+// changes are buffered, and written and synced to disk together in flush().
+class player_journal {
+public:
+
+	player_journal(const std::string& path);
+	player_journal(const player_journal&) = delete;
+	player_journal(player_journal&&) = delete;
+
+	~player_journal() = default;
+
+	player_journal& operator=(const player_journal&) = delete;
+	player_journal& operator=(player_journal&&) = delete;
+
+	void append(const player_change& change);
+	void flush();
+
+	std::vector<player_change> read() const;
+
+	// replaces the journal with these changes, which is also how it is truncated
+	void rewrite(const std::vector<player_change>& changes);
+
+	size_t size() const;
+
+private:
+
+	record_log log;
+
+};
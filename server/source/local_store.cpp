@@ -0,0 +1,142 @@
+#include "local_store.hpp"
+
+static const size_t min_compaction_size = 1024 * 1024;
+
+// a player's fields are stored under the player's prefix, so they can be found together
+static std::string player_prefix(int player_id) {
+	return "player/" + std::to_string(player_id) + "/";
+}
+
+static std::string field_key(const player_change& change) {
+	auto [type, a, b, name] = change.key();
+	return player_prefix(change.player_id) + std::to_string((int)type) + "/" + std::to_string(a) + "/" + std::to_string(b) + "/" + name;
+}
+
+local_store::local_store(const std::string& path) : log{ path } {
+	log.read([this](no::io_stream& record) {
+		std::string key = record.read<std::string>();
+		std::string value = record.read<std::string>();
+		auto old_value = values.find(key);
+		if (old_value != values.end()) {
+			live_size -= record_size(key, old_value->second);
+		}
+		live_size += record_size(key, value);
+		values[key] = std::move(value);
+	});
+	// a torn record at the end would hide everything appended after it
+	compact();
+}
+
+void local_store::put(const std::string& key, const std::string& value) {
+	no::io_stream record;
+	record.write(key);
+	record.write(value);
+	log.append(record);
+	auto old_value = values.find(key);
+	if (old_value != values.end()) {
+		live_size -= record_size(key, old_value->second);
+		old_value->second = value;
+	} else {
+		values.emplace(key, value);
+	}
+	live_size += record_size(key, value);
+}
+
+const std::string* local_store::get(const std::string& key) const {
+	auto value = values.find(key);
+	return value != values.end() ? &value->second : nullptr;
+}
+
+void local_store::for_each(const std::string& prefix, const std::function<void(const std::string&, const std::string&)>& handler) const {
+	for (auto value = values.lower_bound(prefix); value != values.end(); value++) {
+		if (value->first.compare(0, prefix.size(), prefix) != 0) {
+			break;
+		}
+		handler(value->first, value->second);
+	}
+}
+
+void local_store::flush() {
+	log.flush(false);
+	if (log.size() > min_compaction_size && log.size() > live_size * 2) {
+		compact();
+	}
+}
+
+void local_store::compact() {
+	no::io_stream records;
+	for (auto& [key, value] : values) {
+		no::io_stream record;
+		record.write(key);
+		record.write(value);
+		record_log::write_record(records, record);
+	}
+	log.rewrite(records);
+}
+
+size_t local_store::record_size(const std::string& key, const std::string& value) {
+	return 4 * sizeof(uint32_t) + key.size() + value.size();
+}
+
+local_backend::local_backend(const std::string& path) : store{ path } {
+
+}
+
+account_player local_backend::load_account_player(const std::string& account_email) {
+	auto account = store.get(account_key(account_email));
+	if (!account) {
+		return {};
+	}
+	no::io_stream stream{ (char*)account->data(), account->size(), no::io_stream::construct_by::shallow_copy };
+	account_player player;
+	player.id = stream.read<int32_t>();
+	player.display_name = stream.read<std::string>();
+	return player;
+}
+
+// the account name is used as the display name
+account_player local_backend::create_account_player(const std::string& account_email) {
+	if (account_email.empty()) {
+		return {};
+	}
+	if (auto existing = load_account_player(account_email); existing.id != -1) {
+		return existing;
+	}
+	account_player player;
+	player.id = 1;
+	player.display_name = account_email;
+	if (auto stored_id = store.get("next_player_id")) {
+		player.id = std::stoi(*stored_id);
+	}
+	no::io_stream stream;
+	stream.write((int32_t)player.id);
+	stream.write(player.display_name);
+	store.put(account_key(account_email), { stream.data(), stream.write_index() });
+	store.put("next_player_id", std::to_string(player.id + 1));
+	store.flush();
+	return player;
+}
+
+std::string local_backend::account_key(const std::string& account_email) {
+	return "account/" + account_email;
+}
+
+std::vector<player_change> local_backend::load_player(int player_id) {
+	std::vector<player_change> changes;
+	store.for_each(player_prefix(player_id), [&](const std::string&, const std::string& value) {
+		no::io_stream stream{ (char*)value.data(), value.size(), no::io_stream::construct_by::shallow_copy };
+		changes.emplace_back().read(stream);
+	});
+	return changes;
+}
+
+bool local_backend::write(const player_change& change) {
+	no::io_stream stream;
+	change.write(stream);
+	store.put(field_key(change), { stream.data(), stream.write_index() });
+	return true;
+}
+
+void local_backend::flush() {
+	store.flush();
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "persistency.hpp"
+#include "record_log.hpp"
+
+#include <map>
+
+// log-structured key-value store in one local file. every put is appended to the file,
+// and the newest value of each key is kept in memory, so reads never touch the disk.
+// the file is compacted to only the newest values when it is mostly overwritten values.
+class local_store {
+public:
+
+	local_store(const std::string& path);
+	local_store(const local_store&) = delete;
+	local_store(local_store&&) = delete;
+
+	~local_store() = default;
+
+	local_store& operator=(const local_store&) = delete;
+	local_store& operator=(local_store&&) = delete;
+
+	void put(const std::string& key, const std::string& value);
+	const std::string* get(const std::string& key) const;
+	void for_each(const std::string& prefix, const std::function<void(const std::string&, const std::string&)>& handler) const;
+
+	// the puts are handed to the system, but not synced. the player journal covers a crash.
+	void flush();
+	void compact();
+
+private:
+
+	static size_t record_size(const std::string& key, const std::string& value);
+
+	record_log log;
+	std::map<std::string, std::string> values;
+	size_t live_size = 0; // how much of the file the newest values would take up
+
+};
+
+// stores players in a local file instead of postgresql, which is useful for development and load testing.
+// there is no registration, so an account gets a player the first time it logs in.
+class local_backend : public persistence_backend {
+public:
+
+	local_backend(const std::string& path);
+	local_backend(const local_backend&) = delete;
+	local_backend(local_backend&&) = delete;
+
+	~local_backend() override = default;
+
+	local_backend& operator=(const local_backend&) = delete;
+	local_backend& operator=(local_backend&&) = delete;
+
+	account_player load_account_player(const std::string& account_email) override;
+	account_player create_account_player(const std::string& account_email) override;
+	std::vector<player_change> load_player(int player_id) override;
+	bool write(const player_change& change) override;
+	void flush() override;
+
+private:
+
+	static std::string account_key(const std::string& account_email);
+
+	local_store store;
+
+};
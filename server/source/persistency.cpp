@@ -1,22 +1,102 @@
 #include "persistency.hpp"
+#include "backend_worker.hpp"
 #include "network.hpp"
 #include "debug.hpp"
 #include "../config.hpp"
 
+#include <algorithm>
+
+static const Oid unspecified_type = 0;
+static const Oid int4_type = 23;
+static const int text_format = 0;
+static const int binary_format = 1;
+
+// binary integers are in network byte order
+static long long read_big_endian(const char* data, int length) {
+	unsigned long long value = 0;
+	for (int i = 0; i < length; i++) {
+		value = (value << 8) | (unsigned char)data[i];
+	}
+	int bits = length * 8;
+	if (bits > 0 && bits < 64 && (value >> (bits - 1)) & 1) {
+		value |= ~0ull << bits;
+	}
+	return (long long)value;
+}
+
+query_parameters& query_parameters::integer(int value) {
+	uint32_t bits = (uint32_t)value;
+	char bytes[4]{ (char)(bits >> 24), (char)(bits >> 16), (char)(bits >> 8), (char)bits };
+	buffers.emplace_back(bytes, 4);
+	parameter_types.push_back(int4_type);
+	parameter_lengths.push_back(4);
+	parameter_formats.push_back(binary_format);
+	return *this;
+}
+
+query_parameters& query_parameters::text(const std::string& value) {
+	buffers.push_back(value);
+	parameter_types.push_back(unspecified_type);
+	parameter_lengths.push_back((int)value.size());
+	parameter_formats.push_back(text_format);
+	return *this;
+}
+
+int query_parameters::count() const {
+	return (int)buffers.size();
+}
+
+const Oid* query_parameters::types() const {
+	return parameter_types.data();
+}
+
+const char* const* query_parameters::values() const {
+	// the buffers may have moved while parameters were added, so the pointers are taken last
+	value_pointers.clear();
+	for (auto& buffer : buffers) {
+		value_pointers.push_back(buffer.c_str());
+	}
+	return value_pointers.data();
+}
+
+const int* query_parameters::lengths() const {
+	return parameter_lengths.data();
+}
+
+const int* query_parameters::formats() const {
+	return parameter_formats.data();
+}
+
 query_result_row::query_result_row(PGresult* result, int row) : result(result), row(row) {
 
 }
 
+int query_result_row::integer(int column) const {
+	return (int)long_integer(column);
+}
+
+long long query_result_row::long_integer(int column) const {
+	const char* value = PQgetvalue(result, row, column);
+	if (PQfformat(result, column) == binary_format) {
+		return read_big_endian(value, PQgetlength(result, row, column));
+	}
+	return std::stoll(value);
+}
+
+std::string query_result_row::text(int column) const {
+	return { PQgetvalue(result, row, column), (size_t)PQgetlength(result, row, column) };
+}
+
 int query_result_row::integer(const std::string& column) const {
-	return std::stoi(raw(column));
+	return integer(column_index(column));
 }
 
 long long query_result_row::long_integer(const std::string& column) const {
-	return std::stoll(raw(column));
+	return long_integer(column_index(column));
 }
 
 std::string query_result_row::text(const std::string& column) const {
-	return PQgetvalue(result, row, column_index(column));
+	return text(column_index(column));
 }
 
 char* query_result_row::raw(const std::string& column) const {
@@ -49,6 +129,10 @@ query_result_row query_result::row(int index) const {
 	return { result, index };
 }
 
+int query_result::column(const std::string& name) const {
+	return PQfnumber(result, name.c_str());
+}
+
 void query_result::for_each(const std::function<void(const query_result_row&)>& function) const {
 	for (int i = 0; i < count(); i++) {
 		function(row(i));
@@ -97,17 +181,16 @@ query_result database_connection::execute(const std::string& query) const {
 }
 
 query_result database_connection::execute(const std::string& query, const std::initializer_list<std::string>& params) const {
-	ASSERT(16 > params.size());
 	int count = (int)params.size();
 	Oid* types = nullptr; // deduced by backend
-	const char* values[16];
-	for (int i = 0; i < count; i++) {
-		values[i] = (params.begin() + i)->c_str();
+	std::vector<const char*> values;
+	for (auto& param : params) {
+		values.push_back(param.c_str());
 	}
 	int* lengths = nullptr; // we're sending c strings, no need
 	int* formats = nullptr; // sending text, no need
-	int result_format = 0; // text result
-	return { PQexecParams(connection, query.c_str(), count, types, values, lengths, formats, result_format) };
+	int result_format = text_format;
+	return { PQexecParams(connection, query.c_str(), count, types, values.data(), lengths, formats, result_format) };
 }
 
 query_result database_connection::call(const std::string& procedure, const std::initializer_list<std::string>& params) const {
@@ -119,6 +202,35 @@ query_result database_connection::call(const std::string& procedure, const std::
 	return execute(query, params);
 }
 
+query_result database_connection::execute(const prepared_statement& statement, const query_parameters& params) const {
+	if (!prepare(statement, params)) {
+		return { PQexecParams(connection, statement.query.c_str(), params.count(), params.types(), params.values(), params.lengths(), params.formats(), binary_format) };
+	}
+	return { PQexecPrepared(connection, statement.name.c_str(), params.count(), params.values(), params.lengths(), params.formats(), binary_format) };
+}
+
+query_result database_connection::call(const std::string& procedure, const query_parameters& params) const {
+	std::string query = "call " + procedure + " ( ";
+	for (int i = 1; i <= params.count(); i++) {
+		query += "$" + std::to_string(i) + ",";
+	}
+	query[query.size() - 1] = ')';
+	return execute(prepared_statement{ "call_" + procedure, query }, params);
+}
+
+bool database_connection::prepare(const prepared_statement& statement, const query_parameters& params) const {
+	if (prepared_statements.find(statement.name) != prepared_statements.end()) {
+		return true;
+	}
+	// the parameter types are fixed when the statement is prepared
+	query_result result{ PQprepare(connection, statement.name.c_str(), statement.query.c_str(), params.count(), params.types()) };
+	if (result.is_bad()) {
+		return false;
+	}
+	prepared_statements.insert(statement.name);
+	return true;
+}
+
 bool database_connection::is_bad() const {
 	return PQstatus(connection) != CONNECTION_OK;
 }
@@ -127,130 +239,400 @@ std::string database_connection::status_message() const {
 	return PQerrorMessage(connection);
 }
 
-game_persister::game_persister(const database_connection& database) : database(database) {
-
-}
-
-no::vector2i game_persister::load_player_tile(int player_id) {
-	auto result = database.execute("select tile_x, tile_z from player where id = $1", { std::to_string(player_id) });
+static const prepared_statement select_account_player{ "select_account_player", "select id, display_name from player where account_email = $1" };
+
+// each table is read into the same columns, and the kind column tells which table a row is from
+enum class player_row_kind { player, item, stat, variable, quest_task };
+
+static const prepared_statement select_player{ "select_player", R"(
+	select 0 as kind, tile_x as a, tile_z as b, 0 as c, 0 as d, null::varchar as name, null::varchar as value
+	  from player where id = $1
+	union all
+	select 1, container, slot, item, stack, null, null
+	  from item_ownership where player_id = $1
+	union all
+	select 2, stat_type, experience, 0, 0, null, null
+	  from stat where player_id = $1
+	union all
+	select 3, scope, var_type, 0, 0, var_name, var_value
+	  from variable where player_id = $1
+	union all
+	select 4, quest, task, progress, 0, null, null
+	  from quest_task where player_id = $1
+)" };
+
+account_player postgres_backend::load_account_player(const std::string& account_email) {
+	auto result = database.execute(select_account_player, query_parameters{}.text(account_email));
 	if (result.count() != 1) {
 		return {};
 	}
 	auto row = result.row(0);
-	return { row.integer("tile_x"), row.integer("tile_z") };
+	return { row.integer(result.column("id")), row.text(result.column("display_name")) };
+}
+
+std::vector<player_change> postgres_backend::load_player(int player_id) {
+	auto result = database.execute(select_player, query_parameters{}.integer(player_id));
+	std::vector<player_change> changes;
+	int kind_column = result.column("kind");
+	int a_column = result.column("a");
+	int b_column = result.column("b");
+	int c_column = result.column("c");
+	int d_column = result.column("d");
+	int name_column = result.column("name");
+	int value_column = result.column("value");
+	for (int i = 0; i < result.count(); i++) {
+		auto row = result.row(i);
+		auto& change = changes.emplace_back();
+		change.player_id = player_id;
+		change.values[0] = row.integer(a_column);
+		change.values[1] = row.integer(b_column);
+		switch ((player_row_kind)row.integer(kind_column)) {
+		case player_row_kind::player:
+			change.type = player_change::field::tile;
+			break;
+		case player_row_kind::item:
+			change.type = player_change::field::item;
+			change.values[2] = row.integer(c_column);
+			change.values[3] = row.integer(d_column);
+			break;
+		case player_row_kind::stat:
+			change.type = player_change::field::stat;
+			break;
+		case player_row_kind::variable:
+			change.type = player_change::field::variable;
+			change.name = row.text(name_column);
+			change.value = row.text(value_column);
+			break;
+		case player_row_kind::quest_task:
+			change.type = player_change::field::quest_task;
+			change.values[2] = row.integer(c_column);
+			break;
+		}
+	}
+	return changes;
+}
+
+bool postgres_backend::write(const player_change& change) {
+	query_parameters params;
+	params.integer(change.player_id);
+	switch (change.type) {
+	case player_change::field::tile:
+		return !database.call("set_player_tile", params.integer(change.values[0]).integer(change.values[1])).is_bad();
+	case player_change::field::item:
+		params.integer(change.values[0]).integer(change.values[1]).integer(change.values[2]).integer(change.values[3]);
+		return !database.call("set_item_ownership", params).is_bad();
+	case player_change::field::stat:
+		return !database.call("set_stat", params.integer(change.values[0]).integer(change.values[1])).is_bad();
+	case player_change::field::variable:
+		params.integer(change.values[0]).text(change.name).text(change.value).integer(change.values[1]);
+		return !database.call("set_variable", params).is_bad();
+	case player_change::field::quest_task:
+		params.integer(change.values[0]).integer(change.values[1]).integer(change.values[2]);
+		return !database.call("set_quest_task", params).is_bad();
+	default:
+		return false;
+	}
 }
 
-void game_persister::save_player_tile(int player_id, no::vector2i tile) {
-	database.call("set_player_tile", { std::to_string(player_id), std::to_string(tile.x), std::to_string(tile.y) });
+game_persister::game_persister(backend_worker& worker, player_journal& journal) : worker(worker), journal(journal) {
+
 }
 
-game_variable_map game_persister::load_player_variables(int player_id) {
-	auto result = database.execute("select * from variable where player_id = $1", { std::to_string(player_id) });
-	game_variable_map variables;
-	for (int i = 0; i < result.count(); i++) {
-		auto row = result.row(i);
-		int scope = row.integer("scope");
-		std::string name = row.text("var_name");
-		std::string value = row.text("var_value");
-		int type = row.integer("var_type");
-		game_variable variable{ (variable_type)type, name, value, true };
-		if (scope == -1) {
-			variables.create_global(variable);
+void game_persister::load_account_player(const std::string& account_email, const account_loaded& loaded) {
+	worker.queue([account_email](persistence_backend& backend) {
+		auto account = backend.load_account_player(account_email);
+		return account.id != -1 ? account : backend.create_account_player(account_email);
+	}, loaded);
+}
+
+void game_persister::load_player(int player_id, const player_loaded& loaded) {
+	worker.queue([player_id](persistence_backend& backend) {
+		return backend.load_player(player_id);
+	}, loaded);
+}
+
+persisted_player game_persister::restore_player(int player_id, const std::vector<player_change>& stored, character_object& character) {
+	persisted_player player;
+	auto& saved = saved_players[player_id];
+	saved = {};
+	for (auto& change : stored) {
+		apply(change, character, player);
+		remember(saved, change);
+	}
+	// in case changes from the last session are not written yet
+	if (auto pending = changes.find(player_id); pending != changes.end()) {
+		for (auto& change : pending->second) {
+			apply(change.second.change, character, player);
+			remember(saved, change.second.change);
+		}
+	}
+	return player;
+}
+
+void game_persister::apply(const player_change& change, character_object& character, persisted_player& player) {
+	int a = change.values[0];
+	int b = change.values[1];
+	switch (change.type) {
+	case player_change::field::tile:
+		player.tile = { a, b };
+		break;
+	case player_change::field::item:
+	{
+		item_instance* items = nullptr;
+		int count = 0;
+		if (a == inventory_container_type) {
+			items = character.inventory.items;
+			count = character.inventory.slots;
+		} else if (a == equipment_container_type) {
+			items = character.equipment.items;
+			count = (int)equipment_slot::total_slots;
+		}
+		if (b < 0 || b >= count) {
+			WARNING(change.player_id << " has invalid slot " << b << " in " << a);
+			return;
+		}
+		items[b] = { change.values[2], change.values[3] };
+		break;
+	}
+	case player_change::field::stat:
+		if (a < 0 || a >= (int)stat_type::total) {
+			return;
+		}
+		character.stat((stat_type)a).set_experience(b);
+		break;
+	case player_change::field::variable:
+	{
+		game_variable variable{ (variable_type)b, change.name, change.value, true };
+		if (a == -1) {
+			player.variables.create_global(variable);
 		} else {
-			variables.create_local(scope, variable);
+			player.variables.create_local(a, variable);
 		}
+		break;
+	}
+	case player_change::field::quest_task:
+		player.quests.find(a)->add_task_progress(b, change.values[2]);
+		break;
+	}
+}
+
+void game_persister::record_player_tile(int player_id, no::vector2i tile) {
+	auto& saved = saved_players[player_id];
+	if (saved.tile == tile) {
+		return;
 	}
-	return variables;
+	saved.tile = tile;
+	player_change change;
+	change.type = player_change::field::tile;
+	change.player_id = player_id;
+	change.values[0] = tile.x;
+	change.values[1] = tile.y;
+	record(change);
 }
 
-void game_persister::save_player_variables(int player_id, const game_variable_map& variables) {
+void game_persister::record_player_variables(int player_id, const game_variable_map& variables) {
 	variables.for_each_global([this, player_id](const game_variable& variable) {
-		database.call("set_variable", {
-			std::to_string(player_id),
-			"-1",
-			variable.name,
-			variable.value,
-			std::to_string((int)variable.type)
-		});
+		record_player_variable(player_id, -1, variable);
 	});
 	variables.for_each_local([this, player_id](int scope, const game_variable& variable) {
-		database.call("set_variable", {
-			std::to_string(player_id),
-			std::to_string(scope),
-			variable.name,
-			variable.value,
-			std::to_string((int)variable.type)
-		 });
+		record_player_variable(player_id, scope, variable);
 	});
 }
 
-void game_persister::load_player_items(int player_id, int container, item_instance* items, int count) {
-	auto result = database.execute("select * from item_ownership where player_id = $1 and container = $2", {
-		std::to_string(player_id),
-		std::to_string(container)
+void game_persister::record_player_variable(int player_id, int scope, const game_variable& variable) {
+	auto& saved = saved_players[player_id].variables[{ scope, variable.name }];
+	if (saved.value == variable.value && saved.type == (int)variable.type) {
+		return;
+	}
+	saved = { variable.value, (int)variable.type };
+	player_change change;
+	change.type = player_change::field::variable;
+	change.player_id = player_id;
+	change.values[0] = scope;
+	change.values[1] = (int)variable.type;
+	change.name = variable.name;
+	change.value = variable.value;
+	record(change);
+}
+
+void game_persister::record_player_items(int player_id, int container, item_instance* items, int count) {
+	auto& saved = saved_players[player_id].items[container];
+	saved.resize(std::max((int)saved.size(), count));
+	for (int i = 0; i < count; i++) {
+		if (saved[i].definition_id == items[i].definition_id && saved[i].stack == items[i].stack) {
+			continue;
+		}
+		saved[i] = items[i];
+		player_change change;
+		change.type = player_change::field::item;
+		change.player_id = player_id;
+		change.values[0] = container;
+		change.values[1] = i;
+		change.values[2] = items[i].definition_id;
+		change.values[3] = (int)items[i].stack;
+		record(change);
+	}
+}
+
+void game_persister::record_player_quests(int player_id, quest_instance_list& quests) {
+	auto& saved = saved_players[player_id];
+	quests.for_each([&](const quest_instance& quest) {
+		quest.for_each_task([&](const quest_task_instance& task) {
+			auto saved_task = saved.quest_tasks.find({ quest.id(), task.task_id });
+			if (saved_task != saved.quest_tasks.end() && saved_task->second == task.progress) {
+				return;
+			}
+			saved.quest_tasks[{ quest.id(), task.task_id }] = task.progress;
+			player_change change;
+			change.type = player_change::field::quest_task;
+			change.player_id = player_id;
+			change.values[0] = quest.id();
+			change.values[1] = task.task_id;
+			change.values[2] = task.progress;
+			record(change);
+		});
 	});
-	for (int i = 0; i < result.count(); i++) {
-		auto row = result.row(i);
-		int slot = row.integer("slot");
-		if (slot < 0 || slot >= count) {
-			WARNING(player_id << " has invalid slot " << slot << " in " << container);
+}
+
+void game_persister::record_player_stats(int player_id, character_object& character) {
+	auto& saved = saved_players[player_id].experience;
+	saved.resize((size_t)stat_type::total);
+	for (int i = 0; i < (int)stat_type::total; i++) {
+		long long experience = character.stat((stat_type)i).experience();
+		if (saved[i] == experience) {
 			continue;
 		}
-		items[slot] = { row.integer("item"), row.integer("stack") };
+		saved[i] = experience;
+		player_change change;
+		change.type = player_change::field::stat;
+		change.player_id = player_id;
+		change.values[0] = i;
+		change.values[1] = (int)experience; // the experience column is an int
+		record(change);
 	}
 }
 
-void game_persister::save_player_items(int player_id, int container, item_instance* items, int count) {
-	for (int i = 0; i < count; i++) {
-		database.call("set_item_ownership", {
-			std::to_string(player_id),
-			std::to_string(container),
-			std::to_string(i),
-			std::to_string(items[i].definition_id),
-			std::to_string(items[i].stack)
-		 });
+void game_persister::write_player(int player_id) {
+	auto player = changes.find(player_id);
+	if (player == changes.end()) {
+		return;
+	}
+	std::vector<pending_change> writing;
+	for (auto& change : player->second) {
+		writing.push_back(change.second);
 	}
+	total_writes += (int)writing.size();
+	worker.queue([writing](persistence_backend& backend) {
+		std::vector<bool> written;
+		for (auto& change : writing) {
+			written.push_back(backend.write(change.change));
+		}
+		backend.flush();
+		return written;
+	}, [this, player_id, writing](std::vector<bool>& written) {
+		finish_writes(player_id, writing, written);
+	});
 }
 
-quest_instance_list game_persister::load_player_quests(int player_id) {
-	quest_instance_list quests;
-	auto result = database.execute("select * from quest_task where player_id = $1", { std::to_string(player_id) });
-	for (int i = 0; i < result.count(); i++) {
-		auto row = result.row(i);
-		auto quest = quests.find(row.integer("quest"));
-		quest->add_task_progress(row.integer("task"), row.integer("progress"));
+void game_persister::finish_writes(int player_id, const std::vector<pending_change>& writing, const std::vector<bool>& written) {
+	auto player = changes.find(player_id);
+	if (player == changes.end()) {
+		return;
+	}
+	auto& player_changes = player->second;
+	for (size_t i = 0; i < writing.size(); i++) {
+		if (!written[i]) {
+			continue;
+		}
+		auto change = player_changes.find(writing[i].change.key());
+		if (change != player_changes.end() && change->second.sequence == writing[i].sequence) {
+			player_changes.erase(change);
+			total_changes--;
+		}
+	}
+	if (player_changes.empty()) {
+		changes.erase(player);
 	}
-	return quests;
 }
 
-void game_persister::save_player_quests(int player_id, quest_instance_list& quests) {
-	quests.for_each([&](const quest_instance& quest) {
-		quest.for_each_task([&](const quest_task_instance& task) {
-			database.call("set_quest_task", {
-				std::to_string(player_id),
-				std::to_string(quest.id()),
-				std::to_string(task.task_id),
-				std::to_string(task.progress)
-			});
-		});
-	});
+void game_persister::replay_journal() {
+	auto journaled = journal.read();
+	if (journaled.empty()) {
+		journal.rewrite({});
+		return;
+	}
+	INFO("Replaying " << journaled.size() << " journaled player changes");
+	for (auto& change : journaled) {
+		auto& player_changes = changes[change.player_id];
+		auto key = change.key();
+		if (player_changes.find(key) == player_changes.end()) {
+			total_changes++;
+		}
+		player_changes[key] = { change, next_sequence++ };
+	}
+	std::vector<int> players;
+	for (auto& player : changes) {
+		players.push_back(player.first);
+	}
+	for (int player_id : players) {
+		write_player(player_id);
+	}
+	compact_journal();
 }
 
-void game_persister::load_player_stats(int player_id, character_object& character) {
-	auto result = database.execute("select stat_type, experience from stat where player_id = $1", { std::to_string(player_id) });
-	for (int i = 0; i < result.count(); i++) {
-		auto row = result.row(i);
-		stat_type stat = (stat_type)row.integer("stat_type");
-		character.stat(stat).set_experience(row.long_integer("experience"));
+void game_persister::compact_journal() {
+	std::vector<player_change> unwritten;
+	for (auto& player : changes) {
+		for (auto& change : player.second) {
+			unwritten.push_back(change.second.change);
+		}
 	}
+	journal.rewrite(unwritten);
 }
 
-void game_persister::save_player_stats(int player_id, character_object& character) {
-	for (int i = 0; i < (int)stat_type::total; i++) {
-		database.call("set_stat", {
-			std::to_string(player_id),
-			std::to_string(i),
-			std::to_string(character.stat((stat_type)i).experience())
-		});
+int game_persister::pending_changes() const {
+	return total_changes;
+}
+
+void game_persister::record(const player_change& change) {
+	journal.append(change);
+	auto& player_changes = changes[change.player_id];
+	auto key = change.key();
+	if (player_changes.find(key) == player_changes.end()) {
+		total_changes++;
+	}
+	player_changes[key] = { change, next_sequence++ };
+}
+
+void game_persister::remember(saved_player& saved, const player_change& change) {
+	switch (change.type) {
+	case player_change::field::tile:
+		saved.tile = { change.values[0], change.values[1] };
+		break;
+	case player_change::field::item:
+	{
+		auto& items = saved.items[change.values[0]];
+		items.resize(std::max((int)items.size(), change.values[1] + 1));
+		items[change.values[1]] = { change.values[2], change.values[3] };
+		break;
 	}
+	case player_change::field::stat:
+		saved.experience.resize((size_t)stat_type::total);
+		saved.experience[change.values[0]] = change.values[1];
+		break;
+	case player_change::field::variable:
+		saved.variables[{ change.values[0], change.name }] = { change.value, change.values[1] };
+		break;
+	case player_change::field::quest_task:
+		saved.quest_tasks[{ change.values[0], change.values[1] }] = change.values[2];
+		break;
+	}
+}
+
+void game_persister::forget_player(int player_id) {
+	saved_players.erase(player_id);
+}
+
+int game_persister::writes() const {
+	return total_writes;
 }
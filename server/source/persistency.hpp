@@ -6,15 +6,55 @@
 #include "gamevar.hpp"
 #include "character.hpp"
 #include "quest.hpp"
+#include "journal.hpp"
 
 #include <string>
 #include <functional>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
 
+// integers are sent in binary, so the backend does not have to parse them.
+// text is sent with an unspecified type, which lets the backend deduce it from the query.
+class query_parameters {
+public:
+
+	query_parameters& integer(int value);
+	query_parameters& text(const std::string& value);
+
+	int count() const;
+	const Oid* types() const;
+	const char* const* values() const;
+	const int* lengths() const;
+	const int* formats() const;
+
+private:
+
+	std::vector<std::string> buffers;
+	std::vector<Oid> parameter_types;
+	std::vector<int> parameter_lengths;
+	std::vector<int> parameter_formats;
+	mutable std::vector<const char*> value_pointers;
+
+};
+
+// the query is prepared the first time it is executed on a connection, and only the name is sent after that
+struct prepared_statement {
+	std::string name;
+	std::string query;
+};
+
+// columns can be read by name, or by an index found once with query_result::column() for rows read in a loop.
+// integer columns are read from both text and binary results.
 class query_result_row {
 public:
 
 	query_result_row(PGresult* result, int row);
 
+	int integer(int column) const;
+	long long long_integer(int column) const;
+	std::string text(int column) const;
+
 	int integer(const std::string& column) const;
 	long long long_integer(const std::string& column) const;
 	std::string text(const std::string& column) const;
@@ -44,6 +84,7 @@ public:
 	query_result& operator=(query_result&&) = delete;
 
 	query_result_row row(int index) const;
+	int column(const std::string& name) const;
 	void for_each(const std::function<void(const query_result_row&)>& function) const;
 	int count() const;
 	bool is_bad() const;
@@ -70,6 +111,10 @@ public:
 	query_result execute(const std::string& query) const;
 	query_result execute(const std::string& query, const std::initializer_list<std::string>& params) const;
 	query_result call(const std::string& procedure, const std::initializer_list<std::string>& params) const;
+
+	// the results of prepared statements are binary
+	query_result execute(const prepared_statement& statement, const query_parameters& params) const;
+	query_result call(const std::string& procedure, const query_parameters& params) const;
 	
 	// todo: async alternatives
 
@@ -78,32 +123,155 @@ public:
 
 private:
 
+	bool prepare(const prepared_statement& statement, const query_parameters& params) const;
+
 	PGconn* connection = nullptr;
+	mutable std::unordered_set<std::string> prepared_statements;
+
+};
+
+const int inventory_container_type = 0;
+const int equipment_container_type = 1;
+const int warehouse_container_type = 2;
+
+struct account_player {
+	int id = -1;
+	std::string display_name;
+};
+
+// what is stored for a player outside of the character
+struct persisted_player {
+	no::vector2i tile;
+	game_variable_map variables;
+	quest_instance_list quests;
+};
+
+// where players are stored. game_persister decides what to write, and the backend how to store it.
+class persistence_backend {
+public:
+
+	virtual ~persistence_backend() = default;
+
+	// the id is -1 if the account does not have exactly one player
+	virtual account_player load_account_player(const std::string& account_email) = 0;
+
+	// called when an account without a player logs in. the id is -1 if players are not made here.
+	virtual account_player create_account_player(const std::string& account_email) {
+		return {};
+	}
+
+	// everything stored for the player, as the changes that would store it
+	virtual std::vector<player_change> load_player(int player_id) = 0;
+
+	virtual bool write(const player_change& change) = 0;
+
+	// called after a player's changes are written
+	virtual void flush() {}
+
+};
+
+class postgres_backend : public persistence_backend {
+public:
+
+	postgres_backend() = default;
+	postgres_backend(const postgres_backend&) = delete;
+	postgres_backend(postgres_backend&&) = delete;
+
+	~postgres_backend() override = default;
+
+	postgres_backend& operator=(const postgres_backend&) = delete;
+	postgres_backend& operator=(postgres_backend&&) = delete;
+
+	account_player load_account_player(const std::string& account_email) override;
+
+	// reads everything in one round trip
+	std::vector<player_change> load_player(int player_id) override;
+
+	bool write(const player_change& change) override;
+
+private:
+
+	database_connection database;
 
 };
 
+class backend_worker;
+
+// remembers what is stored for each loaded player, and only records the fields that changed since.
+// recorded changes go to the journal right away, and are written to the backend later with write_player().
+// an idle player does not cause any writes.
+// the backend is used through the worker, so loads and writes finish on a later tick.
 class game_persister {
 public:
 
-	game_persister(const database_connection& database);
+	using account_loaded = std::function<void(const account_player&)>;
+	using player_loaded = std::function<void(const std::vector<player_change>&)>;
+
+	game_persister(backend_worker& worker, player_journal& journal);
+
+	void load_account_player(const std::string& account_email, const account_loaded& loaded);
+
+	// loaded is called with what is stored for the player, which is then given to restore_player()
+	void load_player(int player_id, const player_loaded& loaded);
+
+	// items and stats are read into the character. changes not written yet are applied on top of the stored ones.
+	persisted_player restore_player(int player_id, const std::vector<player_change>& stored, character_object& character);
 
-	no::vector2i load_player_tile(int player_id);
-	void save_player_tile(int player_id, no::vector2i tile);
+	void record_player_tile(int player_id, no::vector2i tile);
+	void record_player_variables(int player_id, const game_variable_map& variables);
+	void record_player_items(int player_id, int container, item_instance* items, int count);
+	void record_player_quests(int player_id, quest_instance_list& quests);
+	void record_player_stats(int player_id, character_object& character);
 
-	game_variable_map load_player_variables(int player_id);
-	void save_player_variables(int player_id, const game_variable_map& variables);
+	// queues the recorded changes to be written to the backend.
+	// changes are pending until they are written, and the ones that fail are tried again next time.
+	void write_player(int player_id);
 
-	void load_player_items(int player_id, int container, item_instance* items, int count);
-	void save_player_items(int player_id, int container, item_instance* items, int count);
+	// writes the changes left in the journal by the last run to the backend
+	void replay_journal();
 
-	quest_instance_list load_player_quests(int player_id);
-	void save_player_quests(int player_id, quest_instance_list& quests);
+	// rewrites the journal with only the changes that are not written to the backend yet
+	void compact_journal();
+	int pending_changes() const;
 
-	void load_player_stats(int player_id, character_object& character);
-	void save_player_stats(int player_id, character_object& character);
+	// call after the last save, when the player is no longer loaded
+	void forget_player(int player_id);
+	int writes() const;
 
 private:
 
-	const database_connection& database;
+	struct saved_variable {
+		std::string value;
+		int type = 0;
+	};
+
+	// missing rows are read as empty slots and zero experience, so these start out empty as well
+	struct saved_player {
+		no::vector2i tile;
+		std::unordered_map<int, std::vector<item_instance>> items;
+		std::vector<long long> experience;
+		std::map<std::pair<int, std::string>, saved_variable> variables;
+		std::map<std::pair<int, int>, int> quest_tasks;
+	};
+
+	// a written change is only done if it was not recorded again while it was being written
+	struct pending_change {
+		player_change change;
+		long long sequence = 0;
+	};
+
+	void apply(const player_change& change, character_object& character, persisted_player& player);
+	void record_player_variable(int player_id, int scope, const game_variable& variable);
+	void record(const player_change& change);
+	void remember(saved_player& saved, const player_change& change);
+	void finish_writes(int player_id, const std::vector<pending_change>& writing, const std::vector<bool>& written);
+
+	backend_worker& worker;
+	player_journal& journal;
+	std::unordered_map<int, saved_player> saved_players;
+	std::unordered_map<int, std::map<player_change::field_key, pending_change>> changes;
+	long long next_sequence = 0;
+	int total_changes = 0;
+	int total_writes = 0;
 
 };
@@ -0,0 +1,119 @@
+#include "record_log.hpp"
+#include "platform.hpp"
+#include "debug.hpp"
+
+#include <filesystem>
+
+#if PLATFORM_WINDOWS
+# include <io.h>
+#else
+# include <unistd.h>
+#endif
+
+static const size_t record_header_size = 2 * sizeof(uint32_t);
+
+static uint32_t record_checksum(const char* data, size_t size) {
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static void sync_file(std::FILE* file) {
+	std::fflush(file);
+#if PLATFORM_WINDOWS
+	_commit(_fileno(file));
+#else
+	fsync(fileno(file));
+#endif
+}
+
+record_log::record_log(const std::string& path) : path{ path } {
+	open();
+}
+
+record_log::~record_log() {
+	flush(true);
+	if (file) {
+		std::fclose(file);
+	}
+}
+
+void record_log::write_record(no::io_stream& destination, const no::io_stream& record) {
+	destination.write((uint32_t)record.write_index());
+	destination.write(record_checksum(record.data(), record.write_index()));
+	destination.write(record.data(), record.write_index());
+}
+
+void record_log::append(const no::io_stream& record) {
+	write_record(buffer, record);
+}
+
+void record_log::flush(bool sync) {
+	if (buffer.write_index() == 0 || !file) {
+		return;
+	}
+	std::fwrite(buffer.data(), 1, buffer.write_index(), file);
+	if (sync) {
+		sync_file(file);
+	} else {
+		std::fflush(file);
+	}
+	file_size += buffer.write_index();
+	buffer.set_write_index(0);
+}
+
+void record_log::read(const std::function<void(no::io_stream&)>& handler) const {
+	no::io_stream stream;
+	no::file::read(path, stream);
+	while (stream.size_left_to_read() >= record_header_size) {
+		uint32_t size = stream.read<uint32_t>();
+		uint32_t checksum = stream.read<uint32_t>();
+		if (stream.size_left_to_read() < size || record_checksum(stream.at_read(), size) != checksum) {
+			WARNING("Ignoring a torn record at the end of " << path);
+			break;
+		}
+		no::io_stream record{ stream.at_read(), size, no::io_stream::construct_by::shallow_copy };
+		handler(record);
+		stream.move_read_index(size);
+	}
+}
+
+void record_log::rewrite(const no::io_stream& records) {
+	// a crash leaves either the old or the new file whole
+	std::string temporary_path = path + ".new";
+	std::FILE* temporary = std::fopen(temporary_path.c_str(), "wb");
+	if (!temporary) {
+		WARNING("Failed to open " << temporary_path);
+		return;
+	}
+	std::fwrite(records.data(), 1, records.write_index(), temporary);
+	sync_file(temporary);
+	std::fclose(temporary);
+	if (file) {
+		std::fclose(file);
+		file = nullptr;
+	}
+	std::error_code error;
+	std::filesystem::rename(temporary_path, path, error);
+	if (error) {
+		WARNING("Failed to replace " << path << ": " << error.message());
+	}
+	buffer.set_write_index(0);
+	open();
+}
+
+size_t record_log::size() const {
+	return file_size + buffer.write_index();
+}
+
+void record_log::open() {
+	file = std::fopen(path.c_str(), "ab");
+	if (!file) {
+		WARNING("Failed to open " << path);
+		return;
+	}
+	std::error_code error;
+	file_size = (size_t)std::filesystem::file_size(path, error);
+}
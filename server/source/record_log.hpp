@@ -0,0 +1,48 @@
+#pragma once
+
+#include "io.hpp"
+
+#include <cstdio>
+#include <functional>
+#include <string>
+
+// append-only file of records. appended records are buffered until flush().
+// each record has a length and checksum, so a record torn by a crash is ignored when the log is read.
+class record_log {
+public:
+
+	record_log(const std::string& path);
+	record_log(const record_log&) = delete;
+	record_log(record_log&&) = delete;
+
+	~record_log();
+
+	record_log& operator=(const record_log&) = delete;
+	record_log& operator=(record_log&&) = delete;
+
+	// adds the record with its length and checksum to the destination
+	static void write_record(no::io_stream& destination, const no::io_stream& record);
+
+	void append(const no::io_stream& record);
+
+	// syncing makes sure the records are on the disk, and not just handed to the system
+	void flush(bool sync);
+
+	void read(const std::function<void(no::io_stream&)>& handler) const;
+
+	// replaces the log with records made by write_record(), and drops the buffered records.
+	// the new file is synced before it replaces the old one.
+	void rewrite(const no::io_stream& records);
+
+	size_t size() const;
+
+private:
+
+	void open();
+
+	std::string path;
+	std::FILE* file = nullptr;
+	no::io_stream buffer;
+	size_t file_size = 0;
+
+};
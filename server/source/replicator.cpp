@@ -0,0 +1,113 @@
+#include "replicator.hpp"
+#include "debug.hpp"
+
+#include <algorithm>
+
+void replicator::add_client(int client_index) {
+	clients[client_index] = {};
+}
+
+void replicator::remove_client(int client_index) {
+	clients.erase(client_index);
+}
+
+bool replicator::update(int client_index, const std::vector<entity>& entities, to_client::game::entity_updates& packet) {
+	auto found = clients.find(client_index);
+	if (found == clients.end()) {
+		return false;
+	}
+	auto& client = found->second;
+	client.tick++;
+	candidates.clear();
+	for (int i = 0; i < (int)entities.size(); i++) {
+		auto& record = client.entities[entities[i].state.instance_id];
+		record.relevant_tick = client.tick;
+		if (record.has_sent && !record.needs_resend && record.sent == entities[i].state) {
+			continue;
+		}
+		record.priority += entities[i].weight;
+		candidates.emplace_back(i, &record);
+	}
+	for (auto record = client.entities.begin(); record != client.entities.end();) {
+		if (record->second.relevant_tick != client.tick) {
+			record = client.entities.erase(record);
+		} else {
+			++record;
+		}
+	}
+	if (candidates.empty()) {
+		return false;
+	}
+	std::stable_sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) {
+		return a.second->priority > b.second->priority;
+	});
+	sent_update sent;
+	sent.sequence = client.next_sequence;
+	bit_writer writer;
+	writer.write(0, replication::count_bits);
+	const int max_count = (1 << replication::count_bits) - 1;
+	for (auto& [index, record] : candidates) {
+		if ((int)sent.states.size() == max_count) {
+			break;
+		}
+		const auto& state = entities[index].state;
+		uint32_t baseline_age = sent.sequence - record->baseline_sequence;
+		bool has_baseline = (record->baseline_sequence != 0 && baseline_age <= replication::max_baseline_age);
+		int start = writer.size_in_bits();
+		replication::write_state(writer, has_baseline ? &record->baseline : nullptr, baseline_age, state);
+		// at least one state is sent, so a client can't be stuck behind a budget that is too small
+		if (!sent.states.empty() && writer.size_in_bits() > budget_bytes_per_tick * 8) {
+			writer.truncate(start);
+			break;
+		}
+		record->sent = state;
+		record->has_sent = true;
+		record->needs_resend = false;
+		record->priority = 0;
+		sent.states.push_back(state);
+	}
+	writer.write_at(0, (uint32_t)sent.states.size(), replication::count_bits);
+	packet.sequence = sent.sequence;
+	packet.bits = writer.bytes();
+	client.next_sequence++;
+	client.unacknowledged.push_back(std::move(sent));
+	if ((int)client.unacknowledged.size() > max_unacknowledged) {
+		lose(client, client.unacknowledged.front());
+		client.unacknowledged.pop_front();
+	}
+	return true;
+}
+
+void replicator::acknowledge(int client_index, uint32_t sequence) {
+	auto found = clients.find(client_index);
+	if (found == clients.end()) {
+		return;
+	}
+	auto& client = found->second;
+	// updates before the acknowledged one were not received
+	while (!client.unacknowledged.empty() && client.unacknowledged.front().sequence <= sequence) {
+		auto& update = client.unacknowledged.front();
+		if (update.sequence != sequence) {
+			lose(client, update);
+			client.unacknowledged.pop_front();
+			continue;
+		}
+		for (auto& state : update.states) {
+			auto record = client.entities.find(state.instance_id);
+			if (record != client.entities.end() && record->second.baseline_sequence < sequence) {
+				record->second.baseline = state;
+				record->second.baseline_sequence = sequence;
+			}
+		}
+		client.unacknowledged.pop_front();
+	}
+}
+
+void replicator::lose(client_replication& client, const sent_update& update) {
+	for (auto& state : update.states) {
+		auto record = client.entities.find(state.instance_id);
+		if (record != client.entities.end()) {
+			record->second.needs_resend = true;
+		}
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "replication.hpp"
+#include "packets.hpp"
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+// sends each client the characters around it that changed since it last got them, relative to what it has confirmed.
+// characters that do not fit in the budget wait, and gain priority by their weight each tick they wait.
+class replicator {
+public:
+
+	static const int budget_bytes_per_tick = 1024;
+
+	// when a client has this many updates it has not confirmed, the oldest is treated as lost
+	static const int max_unacknowledged = 64;
+
+	struct entity {
+		replicated_state state;
+		int weight = 1;
+	};
+
+	replicator() = default;
+	replicator(const replicator&) = delete;
+	replicator(replicator&&) = delete;
+
+	~replicator() = default;
+
+	replicator& operator=(const replicator&) = delete;
+	replicator& operator=(replicator&&) = delete;
+
+	void add_client(int client_index);
+	void remove_client(int client_index);
+
+	// the entities are the ones relevant to the client this tick. the others are forgotten, and sent in full if they come back.
+	// returns false if there is nothing to send.
+	bool update(int client_index, const std::vector<entity>& entities, to_client::game::entity_updates& packet);
+	void acknowledge(int client_index, uint32_t sequence);
+
+private:
+
+	struct entity_record {
+		replicated_state baseline;
+		uint32_t baseline_sequence = 0; // 0 if the client has no baseline
+		replicated_state sent;
+		bool has_sent = false;
+		bool needs_resend = false;
+		int priority = 0;
+		unsigned long long relevant_tick = 0;
+	};
+
+	struct sent_update {
+		uint32_t sequence = 0;
+		std::vector<replicated_state> states;
+	};
+
+	struct client_replication {
+		std::unordered_map<int, entity_record> entities;
+		std::deque<sent_update> unacknowledged;
+		uint32_t next_sequence = 1;
+		unsigned long long tick = 0;
+	};
+
+	void lose(client_replication& client, const sent_update& update);
+
+	std::unordered_map<int, client_replication> clients;
+	std::vector<std::pair<int, entity_record*>> candidates;
+
+};
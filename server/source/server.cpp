@@ -5,7 +5,19 @@
 #include "assets.hpp"
 #include "packets.hpp"
 
-server_state::server_state() : persister{ database }, world{ *this, "main" } {
+#include <algorithm>
+#include <cmath>
+
+static std::unique_ptr<persistence_backend> make_persistence_backend() {
+	if (config::database::use_local_store) {
+		INFO("Storing players in " << config::database::local_store_path);
+		return std::make_unique<local_backend>(config::database::local_store_path);
+	}
+	return std::make_unique<postgres_backend>();
+}
+
+server_state::server_state() : backend{ make_persistence_backend() }, journal{ "player_journal.bin" }, worker{ *backend }, persister{ worker, journal }, world{ *this, "main" } {
+	persister.replay_journal();
 	listener = no::open_socket();
 	no::bind_socket(listener, config::host, config::port);
 	no::listen_socket(listener);
@@ -19,17 +31,25 @@ server_state::server_state() : persister{ database }, world{ *this, "main" } {
 		packet.damage = event.damage;
 		no::broadcast(packet);
 	});
+	register_packet_handlers();
+	schedule_journal();
 }
 
 server_state::~server_state() {
-	for (int i = 0; i < config::max_clients; i++) {
-		save_player(i);
-	}
+	clients.for_each([this](int client_index, client_state& client) {
+		save_player(client_index);
+	});
+	worker.wait();
+	persister.compact_journal();
 	world.combat.events.hit.ignore(combat_hit_event_id);
+	router.for_each_statistics([](uint16_t type, const no::packet_type_statistics& statistics) {
+		INFO("Packet " << type << ": " << statistics.count << " received, " << statistics.bytes << " bytes, " << statistics.handler_microseconds << " us handling");
+	});
 }
 
 void server_state::update() {
 	no::synchronize_sockets();
+	worker.complete();
 	for (int i = 0; i < (int)updaters.size(); i++) {
 		updaters[i].update();
 		if (updaters[i].is_done()) {
@@ -37,46 +57,27 @@ void server_state::update() {
 			i--;
 		}
 	}
-	for (int i = 0; i < config::max_clients; i++) {
-		if (clients[i].is_connected() && clients[i].last_saved.seconds() > config::save_interval_seconds) {
-			save_player(i);
-		}
-	}
 	world.update();
+	save_due_players();
 	world.events.kill.all([&](const server_world::kill_event& event) {
 		const auto& definition = world.objects.object(event.target_id).definition();
-		if (definition.script_id.killed >= 0) {
-			for (auto& client : clients) {
-				if (client.object.player_instance_id == event.attacker_id) {
-					auto player = world.objects.character(event.attacker_id);
-					script_tree script;
-					script.quests = &client.player.quests;
-					script.variables = &client.player.variables;
-					script.player_object_id = client.object.player_instance_id;
-					script.inventory = &player->inventory;
-					script.equipment = &player->equipment;
-					script.world = &world;
-					script.load(definition.script_id.killed);
-					script.process_entry_point();
-					break;
-				}
-			}
+		int client_index = clients.client_with_player(event.attacker_id);
+		if (definition.script_id.killed >= 0 && client_index != -1) {
+			auto& client = clients[client_index];
+			auto player = world.objects.character(event.attacker_id);
+			script_tree script;
+			script.quests = &client.player.quests;
+			script.variables = &client.player.variables;
+			script.player_object_id = client.object.player_instance_id;
+			script.inventory = &player->inventory;
+			script.equipment = &player->equipment;
+			script.world = &world;
+			script.load(definition.script_id.killed);
+			script.process_entry_point();
 		}
 		world.combat.stop_all(event.target_id);
 		world.objects.remove(event.target_id);
 	});
-	world.events.move.all([&](const server_world::move_event& event) {
-		to_client::game::update_character_path packet;
-		packet.instance_id = event.object_id;
-		packet.path = event.path;
-		no::broadcast(packet);
-	});
-	world.events.rotate.all([&](const server_world::rotate_event& event) {
-		to_client::game::rotate_object packet;
-		packet.instance_id = event.object_id;
-		packet.rotation = event.rotation;
-		no::broadcast(packet);
-	});
 	for (int i = 0; i < (int)world.fishers.size(); i++) {
 		auto& fisher = world.fishers[i];
 		if (fisher.fished_for.seconds() % 2 == 1) {
@@ -94,50 +95,40 @@ void server_state::update() {
 			character->events.stop_fishing.emit();
 			to_client::game::fish_caught fish_caught;
 			fish_caught.item = { 10, 1 };
-			no::send_packet(fisher.client_index, fish_caught);
+			clients.send(fisher.client_index, fish_caught);
 			fishing_progress.finished = true;
 			world.fishers.erase(world.fishers.begin() + i);
 			i--;
 		}
 		no::broadcast(fishing_progress);
 	}
+	announce_joins();
+	replicate();
 }
 
-int server_state::client_with_player(int player_id) {
-	for (int i = 0; i < config::max_clients; i++) {
-		if (clients[i].object.player_instance_id == player_id) {
-			return i;
-		}
-	}
-	return -1;
-}
-
-character_object* server_state::load_player(int client_index) {
+character_object* server_state::load_player(int client_index, const std::vector<player_change>& stored) {
 	auto& client = clients[client_index];
-	client.object.player_instance_id = world.objects.add(1);
+	clients.set_player(client_index, world.objects.add(1));
 	auto player = world.objects.character(client.object.player_instance_id);
-	no::vector2i tile = persister.load_player_tile(client.player.id);
-	client.player.variables = persister.load_player_variables(client.player.id);
-	client.player.quests = persister.load_player_quests(client.player.id);
-	client.object.player_instance_id = player->object_id;
-	persister.load_player_items(client.player.id, inventory_container_type, player->inventory.items, player->inventory.slots);
-	persister.load_player_items(client.player.id, equipment_container_type, player->equipment.items, (int)equipment_slot::total_slots);
+	auto persisted = persister.restore_player(client.player.id, stored, *player);
+	client.player.variables = std::move(persisted.variables);
+	client.player.quests = std::move(persisted.quests);
 	auto& object = world.objects.object(client.object.player_instance_id);
-	object.transform.position.x = (float)tile.x;
-	object.transform.position.z = (float)tile.y;
+	object.transform.position.x = (float)persisted.tile.x;
+	object.transform.position.z = (float)persisted.tile.y;
 	object.transform.scale = 0.5f;
-	persister.load_player_stats(client.player.id, *player);
 	if (player->stat(stat_type::health).real() == 0) {
 		player->stat(stat_type::health).add_experience(player->stat(stat_type::health).experience_for_level(20));
 	}
 	player->name = client.player.display_name;
 	player->running = true;
+	world.add_player(player->object_id);
 	return player;
 }
 
-void server_state::save_player(int client_index) {
+void server_state::record_player(int client_index) {
 	auto& client = clients[client_index];
-	if (!client.is_connected()) {
+	if (!client.is_connected() || client.object.player_instance_id == -1) {
 		return;
 	}
 	auto player = world.objects.character(client.object.player_instance_id);
@@ -146,87 +137,145 @@ void server_state::save_player(int client_index) {
 		return;
 	}
 	auto& object = world.objects.object(client.object.player_instance_id);
-	persister.save_player_tile(client.player.id, object.tile());
-	persister.save_player_variables(client.player.id, client.player.variables);
-	persister.save_player_quests(client.player.id, client.player.quests);
-	persister.save_player_items(client.player.id, inventory_container_type, player->inventory.items, player->inventory.slots);
-	persister.save_player_items(client.player.id, equipment_container_type, player->equipment.items, (int)equipment_slot::total_slots);
-	persister.save_player_stats(client.player.id, *player);
-	client.last_saved.start();
+	persister.record_player_tile(client.player.id, object.tile());
+	persister.record_player_variables(client.player.id, client.player.variables);
+	persister.record_player_quests(client.player.id, client.player.quests);
+	persister.record_player_items(client.player.id, inventory_container_type, player->inventory.items, player->inventory.slots);
+	persister.record_player_items(client.player.id, equipment_container_type, player->equipment.items, (int)equipment_slot::total_slots);
+	persister.record_player_stats(client.player.id, *player);
+}
+
+void server_state::save_player(int client_index) {
+	auto& client = clients[client_index];
+	if (!client.is_connected()) {
+		return;
+	}
+	record_player(client_index);
+	journal.flush();
+	persister.write_player(client.player.id);
+}
+
+void server_state::schedule_save(int client_index) {
+	long long interval = (long long)config::save_interval_seconds * no::updates_per_second();
+	// the golden ratio spreads the offsets evenly, however many clients there are
+	long long offset = (long long)((double)interval * std::fmod(client_index * 0.6180339887, 1.0));
+	long long ticks = (offset - world.timers.tick()) % interval;
+	if (ticks <= 0) {
+		ticks += interval;
+	}
+	clients[client_index].save_timer = world.timers.schedule(ticks, [this, client_index] {
+		due_saves.push_back(client_index);
+		schedule_save(client_index);
+	});
+}
+
+void server_state::schedule_journal() {
+	world.timers.schedule(journal_interval_seconds * no::updates_per_second(), [this] {
+		clients.for_each([this](int client_index, client_state& client) {
+			record_player(client_index);
+		});
+		journal.flush();
+		bool is_saved = (persister.pending_changes() == 0 && journal.size() > 0);
+		if (is_saved || journal.size() > max_journal_size) {
+			persister.compact_journal();
+		}
+		schedule_journal();
+	});
+}
+
+void server_state::save_due_players() {
+	// at least one player is saved each tick, so a save larger than the budget can't be stuck
+	int saved = 0;
+	int write_limit = persister.writes() + save_writes_per_tick;
+	while (saved < (int)due_saves.size() && (saved == 0 || persister.writes() < write_limit)) {
+		save_player(due_saves[saved]);
+		saved++;
+	}
+	due_saves.erase(due_saves.begin(), due_saves.begin() + saved);
 }
 
-void server_state::connect(int index) {
-	if (index >= config::max_clients) {
+void server_state::connect(int socket_id) {
+	if (clients.count() >= config::max_clients) {
 		// todo: send some message to client to let it know properly
 		WARNING("Rejecting client. Connection limit reached");
 		return;
 	}
-	if (clients[index].is_connected()) {
+	if (clients.client_with_socket(socket_id) != -1) {
 		// todo: check if this can happen
-		WARNING("Rejecting client. This slot is already in use.");
+		WARNING("Rejecting client. This socket is already in use.");
 		return;
 	}
-	INFO("Connecting client " << index);
-	clients[index] = { true };
-	no::socket_event(index).packet.listen([this, index](const no::io_stream& packet) {
-		no::io_stream stream{ packet.data(), packet.size(), no::io_stream::construct_by::shallow_copy };
-		int16_t type = stream.read<int16_t>();
-		on_receive_packet(index, type, stream);
+	int client_index = clients.add(socket_id);
+	INFO("Connecting client " << client_index << " on socket " << socket_id);
+	no::socket_event(socket_id).packet.listen([this, client_index](const no::io_stream& packet) {
+		no::io_stream stream{ packet.data(), packet.write_index(), no::io_stream::construct_by::shallow_copy };
+		if (!router.route(client_index, stream)) {
+			WARNING("Unhandled packet " << stream.read<uint16_t>(0) << " from client " << client_index);
+		}
 	});
-	no::socket_event(index).disconnect.listen([this, index](const no::socket_close_status& status) {
-		INFO("Client " << index << " has disconnected with status " << status);
-		on_disconnect(index);
+	no::socket_event(socket_id).disconnect.listen([this, client_index](const no::socket_close_status& status) {
+		INFO("Client " << client_index << " has disconnected with status " << status);
+		on_disconnect(client_index);
 	});
+	no::set_socket_compression(socket_id, true);
 }
 
-void server_state::on_receive_packet(int client_index, int16_t type, no::io_stream& stream) {
-#define OnPacket(NS, PACKET) case to_server::NS::PACKET::type: on_##PACKET(client_index, { stream }); break
-	switch (type) {
-		OnPacket(game, move_to_tile);
-		OnPacket(game, start_dialogue);
-		OnPacket(game, continue_dialogue);
-		OnPacket(game, chat_message);
-		OnPacket(game, start_combat);
-		OnPacket(game, equip_from_inventory);
-		OnPacket(game, unequip_to_inventory);
-		OnPacket(game, follow_character);
-		OnPacket(game, trade_request);
-		OnPacket(game, add_trade_item);
-		OnPacket(game, remove_trade_item);
-		OnPacket(game, trade_decision);
-		OnPacket(game, started_fishing);
-		OnPacket(game, consume_from_inventory);
-		OnPacket(lobby, login_attempt);
-		OnPacket(lobby, connect_to_world);
-		OnPacket(updates, update_query);
-	}
+void server_state::register_packet_handlers() {
+#define OnPacket(NS, PACKET) router.listen<to_server::NS::PACKET>([this](int client_index, const to_server::NS::PACKET& packet) { on_##PACKET(client_index, packet); })
+	OnPacket(game, move_to_tile);
+	OnPacket(game, start_dialogue);
+	OnPacket(game, continue_dialogue);
+	OnPacket(game, chat_message);
+	OnPacket(game, start_combat);
+	OnPacket(game, equip_from_inventory);
+	OnPacket(game, unequip_to_inventory);
+	OnPacket(game, follow_character);
+	OnPacket(game, trade_request);
+	OnPacket(game, add_trade_item);
+	OnPacket(game, remove_trade_item);
+	OnPacket(game, trade_decision);
+	OnPacket(game, started_fishing);
+	OnPacket(game, consume_from_inventory);
+	OnPacket(game, entity_updates_received);
+	OnPacket(lobby, login_attempt);
+	OnPacket(lobby, connect_to_world);
+	OnPacket(updates, update_query);
 #undef OnPacket
 }
 
 void server_state::on_disconnect(int client_index) {
 	remove_trade(client_index);
 	save_player(client_index);
-	world.objects.remove(clients[client_index].object.player_instance_id);
-	clients[client_index] = { false };
+	persister.forget_player(clients[client_index].player.id);
+	world.timers.cancel(clients[client_index].save_timer);
+	due_saves.erase(std::remove(due_saves.begin(), due_saves.end(), client_index), due_saves.end());
+	joining.erase(std::remove(joining.begin(), joining.end(), client_index), joining.end());
+	replication.remove_client(client_index);
+	int player_instance_id = clients[client_index].object.player_instance_id;
+	world.remove_player(player_instance_id);
+	world.objects.remove(player_instance_id);
+	clients.remove(client_index);
 	to_client::game::player_disconnected disconnection;
-	disconnection.player_instance_id = clients[client_index].object.player_instance_id;
+	disconnection.player_instance_id = player_instance_id;
 	no::broadcast(disconnection);
 }
 
 void server_state::on_move_to_tile(int client_index, const to_server::game::move_to_tile& packet) {
-	auto& client = clients[client_index];
-	to_client::game::move_to_tile new_packet;
-	new_packet.tile = packet.tile;
-	new_packet.player_instance_id = client.object.player_instance_id;
-	auto player = world.objects.character(new_packet.player_instance_id);
+	auto player = world.objects.character(clients[client_index].object.player_instance_id);
 	if (player) {
 		auto& object = world.objects.object(player->object_id);
-		auto path = world.path_between(object.tile(), packet.tile);
-		if (!path.empty() && object.tile() == path.back()) {
-			path.pop_back();
-		}
-		player->start_path_movement(path);
-		no::broadcast(new_packet);
+		int object_id = player->object_id;
+		world.paths.request(object_id, object.tile(), packet.tile, server_world::player_move_priority, [this, object_id](std::vector<no::vector2i>& path) {
+			auto player = world.objects.character(object_id);
+			if (!player) {
+				return;
+			}
+			no::vector2i tile = world.objects.object(object_id).tile();
+			if (!path.empty() && tile == path.back()) {
+				path.pop_back();
+			}
+			player->start_path_movement(path);
+		}, path_search::jump_point);
 	}
 }
 
@@ -271,7 +320,7 @@ void server_state::on_chat_message(int client_index, const to_server::game::chat
 	to_client::game::chat_message client_packet;
 	client_packet.author = clients[client_index].player.display_name;
 	client_packet.message = packet.message;
-	no::broadcast(client_packet, client_index);
+	clients.broadcast(client_packet, client_index);
 }
 
 void server_state::on_start_combat(int client_index, const to_server::game::start_combat& packet) {
@@ -287,7 +336,7 @@ void server_state::on_equip_from_inventory(int client_index, const to_server::ga
 	client_packet.instance_id = client.object.player_instance_id;
 	client_packet.item_id = item.definition_id;
 	client_packet.stack = item.stack;
-	no::broadcast(client_packet, client_index);
+	clients.broadcast(client_packet, client_index);
 }
 
 void server_state::on_unequip_to_inventory(int client_index, const to_server::game::unequip_to_inventory& packet) {
@@ -298,7 +347,7 @@ void server_state::on_unequip_to_inventory(int client_index, const to_server::ga
 	to_client::game::character_unequips client_packet;
 	client_packet.instance_id = client.object.player_instance_id;
 	client_packet.slot = packet.slot;
-	no::broadcast(client_packet, client_index);
+	clients.broadcast(client_packet, client_index);
 }
 
 void server_state::on_follow_character(int client_index, const to_server::game::follow_character& packet) {
@@ -309,8 +358,8 @@ void server_state::on_follow_character(int client_index, const to_server::game::
 		to_client::game::character_follows client_packet;
 		client_packet.follower_id = follower->object_id;
 		client_packet.target_id = packet.target_id;
-		no::broadcast(client_packet, client_index);
-		no::send_packet(client_index, client_packet);
+		clients.broadcast(client_packet, client_index);
+		clients.send(client_index, client_packet);
 	}*/
 }
 
@@ -319,7 +368,7 @@ void server_state::on_trade_request(int client_index, const to_server::game::tra
 	if (find_trade(client_index)) {
 		return;
 	}
-	int target_client_index = client_with_player(packet.trade_with_id);
+	int target_client_index = clients.client_with_player(packet.trade_with_id);
 	if (target_client_index == -1) {
 		return;
 	}
@@ -330,12 +379,12 @@ void server_state::on_trade_request(int client_index, const to_server::game::tra
 		trade.second_client_index = target_client_index;
 		to_client::game::trade_request trade_request;
 		trade_request.trader_id = target_client.object.player_instance_id;
-		no::send_packet(client_index, trade_request);
+		clients.send(client_index, trade_request);
 	}
 	client.sent_trade_request_to_player_id = target_client.object.player_instance_id;
 	to_client::game::trade_request trade_request;
 	trade_request.trader_id = client.object.player_instance_id;
-	no::send_packet(target_client_index, trade_request);
+	clients.send(target_client_index, trade_request);
 }
 
 void server_state::on_add_trade_item(int client_index, const to_server::game::add_trade_item& packet) {
@@ -349,10 +398,10 @@ void server_state::on_add_trade_item(int client_index, const to_server::game::ad
 	add_trade_item.item = item;
 	if (trade->first_client_index == client_index) {
 		trade->first.add_from(item);
-		no::send_packet(trade->second_client_index, add_trade_item);
+		clients.send(trade->second_client_index, add_trade_item);
 	} else if (trade->second_client_index == client_index) {
 		trade->second.add_from(item);
-		no::send_packet(trade->first_client_index, add_trade_item);
+		clients.send(trade->first_client_index, add_trade_item);
 	}
 	trade->first_accepts = false;
 	trade->second_accepts = false;
@@ -369,10 +418,10 @@ void server_state::on_remove_trade_item(int client_index, const to_server::game:
 	item_instance temp;
 	if (trade->first_client_index == client_index) {
 		trade->first.remove_to(trade->first.get(packet.slot).stack, temp);
-		no::send_packet(trade->second_client_index, remove_trade_item);
+		clients.send(trade->second_client_index, remove_trade_item);
 	} else if (trade->second_client_index == client_index) {
 		trade->second.remove_to(trade->second.get(packet.slot).stack, temp);
-		no::send_packet(trade->first_client_index, remove_trade_item);
+		clients.send(trade->first_client_index, remove_trade_item);
 	}
 	trade->first_accepts = false;
 	trade->second_accepts = false;
@@ -388,10 +437,10 @@ void server_state::on_trade_decision(int client_index, const to_server::game::tr
 	trade_decision.accepted = packet.accepted;
 	if (trade->first_client_index == client_index) {
 		trade->first_accepts = packet.accepted;
-		no::send_packet(trade->second_client_index, trade_decision);
+		clients.send(trade->second_client_index, trade_decision);
 	} else if (trade->second_client_index == client_index) {
 		trade->second_accepts = packet.accepted;
-		no::send_packet(trade->first_client_index, trade_decision);
+		clients.send(trade->first_client_index, trade_decision);
 	}
 	if (!packet.accepted) {
 		remove_trade(client_index);
@@ -431,10 +480,10 @@ void server_state::on_started_fishing(int client_index, const to_server::game::s
 	}
 	auto& fisher = world.fishers.emplace_back();
 	fisher.fished_for.start();
-	fisher.last_progress.start();
 	fisher.bait_tile = packet.casted_to_tile;
 	fisher.client_index = client_index;
 	fisher.player_instance_id = client.object.player_instance_id;
+	world.start_fishing_progress(fisher.player_instance_id);
 	player->events.start_fishing.emit();
 	to_client::game::started_fishing started_fishing;
 	started_fishing.instance_id = client.object.player_instance_id;
@@ -452,67 +501,200 @@ void server_state::on_consume_from_inventory(int client_index, const to_server::
 	character->consume_from_inventory(packet.slot);
 }
 
+void server_state::on_entity_updates_received(int client_index, const to_server::game::entity_updates_received& packet) {
+	replication.acknowledge(client_index, packet.sequence);
+}
+
 void server_state::on_login_attempt(int client_index, const to_server::lobby::login_attempt& packet) {
-	auto result = database.execute("select * from player where account_email = $1", { packet.name });
-	if (result.count() != 1) {
+	auto& client = clients[client_index];
+	if (client.is_loading || client.player.id != -1) {
 		return;
 	}
-	auto row = result.row(0);
-	for (auto& client : clients) {
-		if (client.account.email == packet.name) {
+	client.is_loading = true;
+	int session = client.session;
+	std::string email = packet.name;
+	persister.load_account_player(email, [this, client_index, session, email](const account_player& account_player) {
+		if (!clients.is_session(client_index, session)) {
+			return;
+		}
+		auto& client = clients[client_index];
+		client.is_loading = false;
+		if (account_player.id == -1) {
+			return;
+		}
+		// checked when the account is loaded, since another login for it may have finished in the meantime
+		if (clients.client_with_account(email) != -1) {
 			to_client::lobby::login_status login_status;
 			login_status.status = 2;
-			no::send_packet(client_index, login_status);
+			clients.send(client_index, login_status);
 			return;
 		}
-	}
-	auto& client = clients[client_index];
-	client.account.email = row.text("account_email");
-	client.player.id = row.integer("id");
-	client.player.display_name = row.text("display_name");
-	to_client::lobby::login_status login_status;
-	login_status.status = 1;
-	login_status.name = client.player.display_name;
-	no::send_packet(client_index, login_status);
+		clients.set_account(client_index, email);
+		client.player.id = account_player.id;
+		client.player.display_name = account_player.display_name;
+		to_client::lobby::login_status login_status;
+		login_status.status = 1;
+		login_status.name = client.player.display_name;
+		clients.send(client_index, login_status);
+	});
 }
 
 void server_state::on_connect_to_world(int client_index, const to_server::lobby::connect_to_world& packet) {
-	auto player = load_player(client_index);
+	auto& client = clients[client_index];
+	if (client.is_loading || client.player.id == -1 || client.object.player_instance_id != -1) {
+		return;
+	}
+	client.is_loading = true;
+	int session = client.session;
+	persister.load_player(client.player.id, [this, client_index, session](const std::vector<player_change>& stored) {
+		if (!clients.is_session(client_index, session)) {
+			return;
+		}
+		clients[client_index].is_loading = false;
+		enter_world(client_index, stored);
+	});
+}
+
+void server_state::enter_world(int client_index, const std::vector<player_change>& stored) {
+	auto player = load_player(client_index, stored);
+	schedule_save(client_index);
 
 	to_client::game::my_player_info my_info;
 	my_info.player = *player;
 	my_info.object = world.objects.object(player->object_id);
 	my_info.variables = clients[client_index].player.variables;
 	my_info.quests = clients[client_index].player.quests;
-	no::send_packet(client_index, my_info);
-
-	for (int j = 0; j < config::max_clients; j++) {
-		if (clients[j].is_connected() && client_index != j) {
-			auto existing_player = world.objects.character(clients[j].object.player_instance_id);
-			if (!existing_player) {
-				WARNING("Player not found");
-				continue;
-			}
-			to_client::game::other_player_joined other_info;
-			other_info.player = *existing_player;
-			other_info.object = world.objects.object(other_info.player.object_id);
-			no::send_packet(client_index, other_info);
+	clients.send(client_index, my_info);
+
+	// the snapshot is sent with the other joins, when the regions around the player are simulated
+	clients[client_index].is_joining = true;
+	joining.push_back(client_index);
+	replication.add_client(client_index);
+}
+
+player_snapshot server_state::make_player_snapshot(int client_index) {
+	int object_id = clients[client_index].object.player_instance_id;
+	auto player = world.objects.character(object_id);
+	player_snapshot snapshot;
+	snapshot.object = world.objects.object(object_id);
+	snapshot.name = player->name;
+	for (auto& item : player->equipment.items) {
+		if (item.definition_id != -1) {
+			snapshot.equipment.push_back(item);
 		}
 	}
+	for (auto& stat : player->stats) {
+		snapshot.experience.push_back(stat.experience());
+	}
+	return snapshot;
+}
 
-	to_client::game::other_player_joined other_info;
-	other_info.player = *world.objects.character(clients[client_index].object.player_instance_id);
-	other_info.object = world.objects.object(other_info.player.object_id);
-	no::broadcast(other_info, client_index);
+void server_state::send_world_snapshot(int client_index) {
+	auto& player_object = world.objects.object(clients[client_index].object.player_instance_id);
+	to_client::game::world_snapshot snapshot;
+	// events about players are still sent to everyone, so every player must be known
+	clients.for_each([&](int other_client_index, client_state& other_client) {
+		if (!other_client.is_joining && other_client.object.player_instance_id != -1) {
+			snapshot.players.push_back(make_player_snapshot(other_client_index));
+		}
+	});
+	world.objects.for_each([&](character_object* character) {
+		auto& object = world.objects.object(character->object_id);
+		if (clients.client_with_player(character->object_id) != -1 || !world.is_near(player_object, object)) {
+			return;
+		}
+		auto& state = snapshot.characters.emplace_back();
+		state.instance_id = character->object_id;
+		state.tile = object.tile();
+		state.health = character->stat(stat_type::health).effective();
+		state.path = character->target_path;
+	});
+	world.combat.for_each([&](const active_combat& combat) {
+		auto attacker = world.objects.character(combat.attacker_id);
+		auto target = world.objects.character(combat.target_id);
+		if (!attacker || !target) {
+			return;
+		}
+		auto& attacker_object = world.objects.object(combat.attacker_id);
+		auto& target_object = world.objects.object(combat.target_id);
+		if (world.is_near(player_object, attacker_object) || world.is_near(player_object, target_object)) {
+			snapshot.combats.push_back({ combat.attacker_id, combat.target_id });
+		}
+	});
+	clients.send(client_index, snapshot);
+}
+
+void server_state::announce_joins() {
+	if (joining.empty()) {
+		return;
+	}
+	// players joining in the same tick learn about each other from the announcement
+	to_client::game::players_joined players_joined;
+	for (int client_index : joining) {
+		players_joined.players.push_back(make_player_snapshot(client_index));
+		send_world_snapshot(client_index);
+	}
+	for (int client_index : joining) {
+		clients[client_index].is_joining = false;
+	}
+	joining.clear();
+	no::broadcast(players_joined);
+}
+
+void server_state::replicate() {
+	// the states are made once per tick, and each client only looks at the regions around it
+	for (auto& region : entities_by_region) {
+		region.second.clear();
+	}
+	world.objects.for_each([&](character_object* character) {
+		auto& object = world.objects.object(character->object_id);
+		replicator::entity entity;
+		entity.state.instance_id = character->object_id;
+		entity.state.tile = object.tile();
+		// the path is stored goal first
+		entity.state.path_size = std::min((int)character->target_path.size(), replicated_state::max_path_size);
+		for (int i = 0; i < entity.state.path_size; i++) {
+			entity.state.path[i] = character->target_path[character->target_path.size() - 1 - i];
+		}
+		entity.state.rotation = replicated_state::quantize_rotation(object.transform.rotation.y);
+		entity.state.health = character->stat(stat_type::health).effective();
+		entity.weight = (clients.client_with_player(character->object_id) != -1 ? 2 : 1);
+		entities_by_region[world.region_key(world.region_of(object))].push_back(entity);
+	});
+	clients.for_each([&](int client_index, client_state& client) {
+		int player_id = client.object.player_instance_id;
+		if (player_id == -1) {
+			return;
+		}
+		no::vector2i center = world.region_of(world.objects.object(player_id));
+		relevant_entities.clear();
+		for (int y = center.y - server_world::active_region_distance; y <= center.y + server_world::active_region_distance; y++) {
+			for (int x = center.x - server_world::active_region_distance; x <= center.x + server_world::active_region_distance; x++) {
+				auto region = entities_by_region.find(world.region_key({ x, y }));
+				if (region != entities_by_region.end()) {
+					relevant_entities.insert(relevant_entities.end(), region->second.begin(), region->second.end());
+				}
+			}
+		}
+		for (auto& entity : relevant_entities) {
+			if (entity.state.instance_id == player_id) {
+				entity.weight = 4;
+			}
+		}
+		to_client::game::entity_updates updates;
+		if (replication.update(client_index, relevant_entities, updates)) {
+			clients.send(client_index, updates);
+		}
+	});
 }
 
 void server_state::on_update_query(int client_index, const to_server::updates::update_query& packet) {
 	if (packet.version != newest_client_version || packet.needs_assets) {
-		updaters.emplace_back(client_index);
+		updaters.emplace_back(clients[client_index].socket_id);
 	}
 	to_client::updates::latest_version latest_version;
 	latest_version.version = newest_client_version;
-	no::send_packet(client_index, latest_version);
+	clients.send(client_index, latest_version);
 }
 
 trade_state* server_state::find_trade(int client_index) {
@@ -2,6 +2,10 @@
 
 #include "updater.hpp"
 #include "persistency.hpp"
+#include "local_store.hpp"
+#include "backend_worker.hpp"
+#include "client_registry.hpp"
+#include "replicator.hpp"
 #include "loop.hpp"
 #include "network.hpp"
 #include "character.hpp"
@@ -11,49 +15,6 @@
 #include "server_world.hpp"
 #include "../config.hpp"
 
-const int inventory_container_type = 0;
-const int equipment_container_type = 1;
-const int warehouse_container_type = 2;
-
-class client_state {
-public:
-	
-	bool connected = false;
-	no::timer last_saved;
-
-	int sent_trade_request_to_player_id = -1;
-
-	struct {
-		std::string email;
-	} account;
-
-	struct {
-		int id = -1;
-		std::string display_name;
-		game_variable_map variables;
-		quest_instance_list quests;
-	} player;
-
-	struct {
-		int player_instance_id = -1;
-	} object;
-
-	script_tree* dialogue = nullptr;
-
-	client_state() = default;
-	client_state(bool connected) : connected(connected) {}
-	client_state(const client_state&) = delete;
-	client_state(client_state&&) = default;
-
-	client_state& operator=(const client_state&) = delete;
-	client_state& operator=(client_state&&) = default;
-
-	bool is_connected() const {
-		return connected;
-	}
-
-};
-
 struct trade_state {
 
 	inventory_container first;
@@ -70,9 +31,20 @@ struct trade_state {
 class server_state : public no::program_state {
 public:
 
-	database_connection database;
+	std::unique_ptr<persistence_backend> backend;
+	player_journal journal;
+	backend_worker worker;
 	game_persister persister;
 
+	// each client is saved once per save interval, at an offset by client index so saves are spread out.
+	// due saves are done in order until this many writes are made in a tick. the rest wait for the next tick.
+	int save_writes_per_tick = 100;
+
+	// changes are journaled this often, so a crash loses at most this much.
+	// the journal is compacted when it grows past the size, or when everything in it is saved.
+	int journal_interval_seconds = 1;
+	size_t max_journal_size = 4 * 1024 * 1024;
+
 	server_state();
 	~server_state() override;
 
@@ -81,14 +53,21 @@ public:
 
 private:
 
-	int client_with_player(int player_id);
-
-	character_object* load_player(int client_index);
+	character_object* load_player(int client_index, const std::vector<player_change>& stored);
+	void enter_world(int client_index, const std::vector<player_change>& stored);
+	player_snapshot make_player_snapshot(int client_index);
+	void send_world_snapshot(int client_index);
+	void announce_joins();
+	void replicate();
+	void record_player(int client_index);
 	void save_player(int client_index);
+	void schedule_save(int client_index);
+	void schedule_journal();
+	void save_due_players();
 
-	void connect(int index);
+	void connect(int socket_id);
 
-	void on_receive_packet(int client_index, int16_t type, no::io_stream& stream);
+	void register_packet_handlers();
 	void on_disconnect(int client_index);
 
 	void on_move_to_tile(int client_index, const to_server::game::move_to_tile& packet);
@@ -105,6 +84,7 @@ private:
 	void on_trade_decision(int client_index, const to_server::game::trade_decision& packet);
 	void on_started_fishing(int client_index, const to_server::game::started_fishing& packet);
 	void on_consume_from_inventory(int client_index, const to_server::game::consume_from_inventory& packet);
+	void on_entity_updates_received(int client_index, const to_server::game::entity_updates_received& packet);
 
 	void on_login_attempt(int client_index, const to_server::lobby::login_attempt& packet);
 	void on_connect_to_world(int client_index, const to_server::lobby::connect_to_world& packet);
@@ -114,13 +94,21 @@ private:
 	void remove_trade(int client_index);
 
 	int listener = -1;
-	client_state clients[config::max_clients];
+	client_registry clients;
 
 	std::vector<trade_state> trades;
+	std::vector<int> due_saves;
+	std::vector<int> joining;
 
 	server_world world;
 	int combat_hit_event_id = -1;
 
+	replicator replication;
+	std::unordered_map<int64_t, std::vector<replicator::entity>> entities_by_region; // rebuilt each tick
+	std::vector<replicator::entity> relevant_entities;
+
 	std::vector<client_updater> updaters;
 
+	no::packet_router<int> router;
+
 };
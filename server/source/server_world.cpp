@@ -1,58 +1,248 @@
 #include "server_world.hpp"
 #include "pathfinding.hpp"
 #include "server.hpp"
+#include "jobs.hpp"
+
+#include <algorithm>
+
+// the same character gets the same number on the same tick, no matter which thread it is simulated on
+static int character_random(int object_id, unsigned long long tick, int salt, int min, int max) {
+	unsigned long long value = tick * 0x9E3779B97F4A7C15ull + ((unsigned long long)object_id << 8) + (unsigned long long)salt;
+	value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+	value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+	value ^= value >> 31;
+	return min + (int)(value % (unsigned long long)(max - min + 1));
+}
 
 server_world::server_world(server_state& server, const std::string& name) : server{ server }, combat{ *this } {
 	this->name = name;
+	// characters are read after they are added, so whether they walk around is checked when the timer fires
+	object_add_event = objects.events.add.listen([this](const game_object& object) {
+		if (object.definition().type == game_object_type::character) {
+			int second = no::updates_per_second();
+			schedule_random_walk(object.instance_id, character_random(object.instance_id, timers.tick(), 3, 0, 15 * second));
+		}
+	});
+	object_remove_event = objects.events.remove.listen([this](const game_object& object) {
+		if (auto timer = walk_timers.find(object.instance_id); timer != walk_timers.end()) {
+			timers.cancel(timer->second);
+			walk_timers.erase(timer);
+		}
+	});
 	objects.load();
 	terrain.load(1);
 }
 
+server_world::~server_world() {
+	objects.events.add.ignore(object_add_event);
+	objects.events.remove.ignore(object_remove_event);
+}
+
 void server_world::update() {
-	world_state::update();
-	combat.update();
-	update_fishing();
-	objects.for_each([this](character_object* character) {
-		auto& object = objects.object(character->object_id);
-		update_random_walk_movement(*character, object);
+	// world_state::update() is not called, since the characters are updated by region here
+	timers.advance();
+	paths.update();
+	update_active_regions();
+	partition_regions();
+	simulate_regions([this](character_object& character, game_object& object, region_batch& batch) {
+		no::vector2i tile = object.tile();
+		bool was_moving = !character.target_path.empty();
+		character.update(*this, object);
+		bool moved = (object.tile() != tile || (was_moving && character.target_path.empty()));
+		if (moved && combat.is_in_combat(character.object_id)) {
+			batch.moved_in_combat.push_back(character.object_id);
+		}
 	});
+	for (auto& batch : batches) {
+		for (int object_id : batch.moved_in_combat) {
+			combat.character_moved(object_id);
+		}
+	}
 }
 
-void server_world::update_fishing() {
-	for (auto& fisher : fishers) {
-		if (fisher.last_progress.seconds() < 1 || fisher.finished) {
-			continue;
+void server_world::start_fishing_progress(int player_instance_id) {
+	timers.schedule(no::updates_per_second(), [this, player_instance_id] {
+		for (auto& fisher : fishers) {
+			if (fisher.player_instance_id == player_instance_id && !fisher.finished) {
+				progress_fishing(fisher);
+				if (!fisher.finished) {
+					start_fishing_progress(player_instance_id);
+				}
+				break;
+			}
 		}
-		auto& object = objects.object(fisher.player_instance_id);
-		no::vector2i tile = object.tile();
-		bool left = (tile.x < fisher.bait_tile.x);
-		bool right = (tile.x > fisher.bait_tile.x);
-		bool up = (tile.y < fisher.bait_tile.y);
-		bool down = (tile.y > fisher.bait_tile.y);
-		fisher.bait_tile.x += (left ? -1 : (right ? 1 : 0));
-		fisher.bait_tile.y += (up ? -1 : (down ? 1 : 0));
-		if (fisher.bait_tile == tile) {
-			fisher.finished = true;
+	});
+}
+
+void server_world::add_player(int object_id) {
+	players.push_back(object_id);
+}
+
+void server_world::remove_player(int object_id) {
+	players.erase(std::remove(players.begin(), players.end(), object_id), players.end());
+}
+
+int server_world::dormant_regions() const {
+	return (int)dormant_since.size();
+}
+
+bool server_world::is_near(const game_object& player, const game_object& object) const {
+	no::vector2i player_region = region_of(player);
+	no::vector2i object_region = region_of(object);
+	return std::abs(player_region.x - object_region.x) <= active_region_distance && std::abs(player_region.y - object_region.y) <= active_region_distance;
+}
+
+int64_t server_world::region_key(no::vector2i region) {
+	return ((int64_t)region.x << 32) | (uint32_t)region.y;
+}
+
+no::vector2i server_world::region_of(const game_object& object) const {
+	no::vector2i tile = object.tile();
+	return { (int)std::floor((float)tile.x / region_width), (int)std::floor((float)tile.y / region_width) };
+}
+
+void server_world::update_active_regions() {
+	active_regions.clear();
+	for (int player_id : players) {
+		no::vector2i center = region_of(objects.object(player_id));
+		for (int y = center.y - active_region_distance; y <= center.y + active_region_distance; y++) {
+			for (int x = center.x - active_region_distance; x <= center.x + active_region_distance; x++) {
+				active_regions.insert(region_key({ x, y }));
+			}
 		}
-		if (!terrain.tile_at(fisher.bait_tile).is_water()) {
-			fisher.finished = true;
+	}
+	waking_regions.clear();
+	for (int64_t key : active_regions) {
+		if (auto region = dormant_since.find(key); region != dormant_since.end()) {
+			waking_regions.emplace(key, (unsigned long long)timers.tick() - region->second);
+			dormant_since.erase(region);
 		}
-		fisher.last_progress.start();
 	}
 }
 
-void server_world::update_random_walk_movement(character_object& character, game_object& object) {
-	if (!character.walking_around || !character.target_path.empty()) {
+void server_world::fast_forward(character_object& character, game_object& object, unsigned long long elapsed_ticks) const {
+	if (character.target_path.empty()) {
 		return;
 	}
-	if (character.walk_around_timer.has_started() && character.walk_around_timer.milliseconds() < random.next(10000, 15000)) {
+	// characters move at most their speed along each axis per tick, so this is how many tiles they could have walked
+	unsigned long long tiles = (unsigned long long)(character.speed() * (float)elapsed_ticks);
+	if (tiles == 0) {
 		return;
 	}
-	if (combat.is_in_combat(character.object_id)) {
+	no::vector2i reached_tile;
+	while (tiles > 0 && !character.target_path.empty()) {
+		reached_tile = character.target_path.back();
+		character.target_path.pop_back();
+		tiles--;
+	}
+	no::vector3f position = tile_index_to_world_position(reached_tile);
+	object.transform.position.x = position.x;
+	object.transform.position.z = position.z;
+}
+
+void server_world::partition_regions() {
+	regions.clear();
+	std::unordered_map<int64_t, int> region_indices;
+	objects.for_each([&](character_object* character) {
+		auto& object = objects.object(character->object_id);
+		no::vector2i index = region_of(object);
+		int64_t key = region_key(index);
+		if (active_regions.count(key) == 0) {
+			dormant_since.emplace(key, (unsigned long long)timers.tick());
+			return;
+		}
+		if (auto waking = waking_regions.find(key); waking != waking_regions.end()) {
+			fast_forward(*character, object, waking->second);
+		}
+		auto region = region_indices.find(key);
+		if (region == region_indices.end()) {
+			region = region_indices.emplace(key, (int)regions.size()).first;
+			regions.push_back({ index });
+		}
+		regions[region->second].characters.push_back(character);
+	});
+	// the order of the regions decides the order queued work is applied in, so it must not depend on the characters
+	std::sort(regions.begin(), regions.end(), [](const simulation_region& a, const simulation_region& b) {
+		return a.index.y < b.index.y || (a.index.y == b.index.y && a.index.x < b.index.x);
+	});
+	// rebalance every tick, so crowded regions don't leave other threads idle
+	batches.clear();
+	int batch_count = (simulate_in_parallel ? (no::job_workers() + 1) * 4 : 1);
+	int characters = 0;
+	for (auto& region : regions) {
+		characters += (int)region.characters.size();
+	}
+	int characters_per_batch = std::max(1, (characters + batch_count - 1) / batch_count);
+	int batch_characters = 0;
+	for (int i = 0; i < (int)regions.size(); i++) {
+		if (batches.empty() || batch_characters >= characters_per_batch) {
+			batches.push_back({ i, i });
+			batch_characters = 0;
+		}
+		batches.back().last_region = i;
+		batch_characters += (int)regions[i].characters.size();
+	}
+}
+
+template<typename F>
+void server_world::simulate_regions(const F& function) {
+	no::parallel_for(0, (int)batches.size(), 1, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			auto& batch = batches[i];
+			for (int region = batch.first_region; region <= batch.last_region; region++) {
+				for (auto character : regions[region].characters) {
+					function(*character, objects.object(character->object_id), batch);
+				}
+			}
+		}
+	});
+}
+
+void server_world::progress_fishing(fishing_state& fisher) {
+	auto& object = objects.object(fisher.player_instance_id);
+	no::vector2i tile = object.tile();
+	bool left = (tile.x < fisher.bait_tile.x);
+	bool right = (tile.x > fisher.bait_tile.x);
+	bool up = (tile.y < fisher.bait_tile.y);
+	bool down = (tile.y > fisher.bait_tile.y);
+	fisher.bait_tile.x += (left ? -1 : (right ? 1 : 0));
+	fisher.bait_tile.y += (up ? -1 : (down ? 1 : 0));
+	if (fisher.bait_tile == tile) {
+		fisher.finished = true;
+	}
+	if (!terrain.tile_at(fisher.bait_tile).is_water()) {
+		fisher.finished = true;
+	}
+}
+
+void server_world::schedule_random_walk(int object_id, long long ticks) {
+	walk_timers[object_id] = timers.schedule(ticks, [this, object_id] {
+		walk_timers.erase(object_id);
+		start_random_walk(object_id);
+	});
+}
+
+void server_world::start_random_walk(int object_id) {
+	const int second = no::updates_per_second();
+	auto& object = objects.object(object_id);
+	if (active_regions.count(region_key(region_of(object))) == 0) {
+		schedule_random_walk(object_id, character_random(object_id, timers.tick(), 0, 10 * second, 15 * second));
+		return;
+	}
+	auto character = objects.character(object_id);
+	if (!character || !character->walking_around) {
 		return;
 	}
-	no::vector2i distance{ random.next(-8, 8), random.next(-8, 8) };
-	auto path = path_between(object.tile(), character.walking_around_center + distance);
-	character.start_path_movement(path);
-	events.move.emplace_and_push(character.object_id, path);
+	if (!character->target_path.empty() || paths.has_request(object_id) || combat.is_in_combat(object_id)) {
+		schedule_random_walk(object_id, second);
+		return;
+	}
+	no::vector2i distance{ character_random(object_id, timers.tick(), 1, -8, 8), character_random(object_id, timers.tick(), 2, -8, 8) };
+	paths.request(object_id, object.tile(), character->walking_around_center + distance, walk_priority, [this, object_id](std::vector<no::vector2i>& path) {
+		if (auto character = objects.character(object_id)) {
+			character->start_path_movement(path);
+		}
+	}, path_search::jump_point);
+	// the next walk is timed from now, even if another request replaces this one
+	schedule_random_walk(object_id, character_random(object_id, timers.tick(), 0, 10 * second, 15 * second));
 }
@@ -2,38 +2,34 @@
 
 #include "world.hpp"
 #include "combat.hpp"
+#include "timer_wheel.hpp"
+
+#include <unordered_map>
+#include <unordered_set>
 
 class server_state;
 
 class server_world : public world_state {
 public:
 
+	// players are waiting for their own moves, and should not be stuck behind wandering characters
+	static const int player_move_priority = 2;
+	static const int combat_priority = 1;
+	static const int walk_priority = 0;
+
 	struct kill_event {
 		int attacker_id = -1;
 		int target_id = -1;
 	};
 
-	struct move_event {
-		int object_id = -1;
-		std::vector<no::vector2i> path;
-	};
-
-	struct rotate_event {
-		int object_id = -1;
-		no::vector3f rotation;
-	};
-
 	struct {
 		no::event_message_queue<kill_event> kill;
-		no::event_message_queue<move_event> move;
-		no::event_message_queue<rotate_event> rotate;
 	} events;
 
 	combat_system combat;
 
 	struct fishing_state {
 		no::timer fished_for;
-		no::timer last_progress;
 		int client_index = -1;
 		int player_instance_id = -1;
 		no::vector2i bait_tile;
@@ -42,16 +38,72 @@ public:
 
 	std::vector<fishing_state> fishers;
 
+	// advanced once per update. timed events are scheduled here instead of polling timers every update.
+	no::timer_wheel timers;
+
+	// characters are simulated in parallel, in batches of regions with about the same number of characters.
+	// random walks are started from timers, and combats are told about moves after the batches, in region order.
+	static const int region_width = 32;
+	bool simulate_in_parallel = true;
+
+	// regions further than this from every player are dormant, and their characters are not simulated.
+	// when a player comes close again, the characters are moved as far along their paths as they would have walked.
+	static const int active_region_distance = 1;
+
 	server_world(server_state& server, const std::string& name);
+	server_world(const server_world&) = delete;
+	server_world(server_world&&) = delete;
+
+	~server_world() override;
+
+	server_world& operator=(const server_world&) = delete;
+	server_world& operator=(server_world&&) = delete;
 
 	void update() override;
+	void start_fishing_progress(int player_instance_id);
+
+	void add_player(int object_id);
+	void remove_player(int object_id);
+	int dormant_regions() const;
+
+	// true if the object is in one of the regions that are active around the player
+	bool is_near(const game_object& player, const game_object& object) const;
+
+	static int64_t region_key(no::vector2i region);
+	no::vector2i region_of(const game_object& object) const;
 
 private:
 
-	void update_fishing();
-	void update_random_walk_movement(character_object& character, game_object& object);
+	struct simulation_region {
+		no::vector2i index;
+		std::vector<character_object*> characters;
+	};
+
+	struct region_batch {
+		int first_region = 0;
+		int last_region = 0;
+		std::vector<int> moved_in_combat;
+	};
+
+	void update_active_regions();
+	void fast_forward(character_object& character, game_object& object, unsigned long long elapsed_ticks) const;
+	void partition_regions();
+	template<typename F>
+	void simulate_regions(const F& function);
+
+	void progress_fishing(fishing_state& fisher);
+	void schedule_random_walk(int object_id, long long ticks);
+	void start_random_walk(int object_id);
 
 	server_state& server;
-	no::random_number_generator random;
+	std::vector<simulation_region> regions;
+	std::vector<region_batch> batches;
+	std::vector<int> players;
+	std::unordered_set<int64_t> active_regions;
+	std::unordered_map<int64_t, unsigned long long> dormant_since; // region key to the tick it went dormant
+	std::unordered_map<int64_t, unsigned long long> waking_regions; // region key to how many ticks it slept
+	std::unordered_map<int, long long> walk_timers;
+	int object_add_event = -1;
+	int object_remove_event = -1;
 
 };
@@ -49,8 +49,7 @@ void client_updater::update() {
 	packet.total_files = total_files;
 	packet.offset = (int64_t)stream.read_index();
 	packet.total_size = (int64_t)stream.write_index();
-	packet.data.resize(packet_size);
-	stream.read(packet.data.data(), packet_size);
+	packet.data = { stream.at_read(), (int32_t)packet_size };
 	no::send_packet(client, packet);
 	paths.pop_back();
 }